@@ -0,0 +1,296 @@
+// bench.cpp
+
+// Headless benchmark of the LuaBox host core, runs scripts on synthetic input without Rack
+// Build and run with `make bench` from the repository root
+
+#include "LuaScript.hpp"
+#include <glob.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+struct BenchResult
+{
+    std::string script;
+    int sampleRate = 0;
+    std::string mode;
+    bool ok = false;
+    std::string error;
+    int64_t frames = 0;
+    double seconds = 0.0;
+    double gcSeconds = 0.0;
+    size_t allocations = 0;
+    size_t peakKB = 0;
+};
+
+struct BenchOptions
+{
+    double seconds = 10.0;
+    int blockSize = 64;
+    int gcBudget = 50;
+    std::vector<int> sampleRates = {44100, 48000, 96000};
+    std::string libDir = "res/lua";
+    std::string jsonPath;
+    std::vector<std::string> scripts;
+};
+
+// Script output is not part of the benchmark, only warnings are shown
+static void logMessage(int level, const char *message)
+{
+    if (level >= 2)
+        std::fprintf(stderr, "%s\n", message);
+}
+
+static void globScripts(const char *pattern, std::vector<std::string> &paths)
+{
+    glob_t g;
+    if (glob(pattern, 0, nullptr, &g) == 0)
+    {
+        for (size_t i = 0; i < g.gl_pathc; i++)
+            paths.push_back(g.gl_pathv[i]);
+    }
+    globfree(&g);
+}
+
+static bool readFile(const std::string &path, std::string &contents)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+static std::string baseName(const std::string &path)
+{
+    size_t slash = path.find_last_of("/\\");
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+static std::string dirName(const std::string &path)
+{
+    size_t slash = path.find_last_of("/\\");
+    return slash == std::string::npos ? "." : path.substr(0, slash);
+}
+
+// Deterministic test signals: slow sines on the inputs, ramps on the knobs and gates on the buttons
+static void fillFrame(LuaProcessBlock &block, int64_t frame, int n)
+{
+    double t = (double)frame / block.samplerate;
+    for (int i = 0; i < NUM_ROWS; i++)
+    {
+        float input = 5.f * (float)std::sin(2.0 * M_PI * (0.5 + i) * t);
+        float knob = (float)std::fmod(t * 0.1 * (i + 1), 2.0) - 1.f;
+        bool button = ((frame >> (12 + i)) & 1) != 0;
+
+        block.input[i] = input;
+        block.knob[i] = knob;
+        block.button[i] = button;
+        block.inputs[i][n] = input;
+        block.knobs[i][n] = knob;
+        block.buttons[i][n] = button;
+        block.inchannels[i] = 1;
+        block.polyinput[i][0] = input;
+        block.polyinputs[n][i][0] = input;
+    }
+}
+
+static BenchResult runBench(const BenchOptions &options, const std::string &path, int sampleRate)
+{
+    BenchResult result;
+    result.script = path;
+    result.sampleRate = sampleRate;
+
+    std::string source;
+    if (!readFile(path, source))
+    {
+        result.error = "Could not read file";
+        return result;
+    }
+
+    LuaScript script;
+    script.sampleDir = dirName(path);
+    script.resetBlock((float)sampleRate, options.blockSize);
+    if (!script.load(source, "=" + baseName(path), options.libDir))
+    {
+        result.error = script.errorMessage;
+        return result;
+    }
+    result.mode = script.blockMode ? "process_block" : "process";
+
+    int64_t totalFrames = (int64_t)(options.seconds * sampleRate);
+    int blockSize = options.blockSize;
+    size_t allocations = script.arena ? script.arena->getAllocations() : 0;
+    uint64_t start = LuaProfiler::getNanoseconds();
+
+    // Same call pattern as the module, one GC step per block
+    bool ok = true;
+    int64_t frame = 0;
+    while (ok && frame < totalFrames)
+    {
+        int frames = (int)std::min<int64_t>(blockSize, totalFrames - frame);
+        if (script.blockMode)
+        {
+            for (int n = 0; n < frames; n++)
+                fillFrame(script.block, frame + n, n);
+            script.block.frame = frame;
+            script.block.blocksize = frames;
+            ok = script.runBlock(frames);
+        }
+        else
+        {
+            for (int n = 0; n < frames && ok; n++)
+            {
+                fillFrame(script.block, frame + n, 0);
+                script.block.frame = frame + n;
+                ok = script.run();
+            }
+        }
+        result.gcSeconds += script.collectGarbage(options.gcBudget * 1e-6);
+        frame += frames;
+    }
+
+    result.seconds = (LuaProfiler::getNanoseconds() - start) * 1e-9;
+    result.frames = frame;
+    result.ok = ok;
+    if (!ok)
+        result.error = script.errorMessage;
+    if (script.arena)
+    {
+        result.allocations = script.arena->getAllocations() - allocations;
+        result.peakKB = script.arena->getPeak() >> 10;
+    }
+    return result;
+}
+
+static std::string jsonEscape(const std::string &s)
+{
+    std::string out;
+    for (char c : s)
+    {
+        if (c == '"' || c == '\\')
+            out += '\\', out += c;
+        else if (c == '\n')
+            out += "\\n";
+        else if ((unsigned char)c < 0x20)
+            out += ' ';
+        else
+            out += c;
+    }
+    return out;
+}
+
+// One result per line, in a stable order, so runs from different commits diff cleanly
+static bool writeJson(const std::string &path, const BenchOptions &options, const std::vector<BenchResult> &results)
+{
+    FILE *file = std::fopen(path.c_str(), "w");
+    if (!file)
+        return false;
+
+    std::fprintf(file, "{\n  \"luajit\": \"%s\",\n  \"seconds\": %g,\n  \"blockSize\": %d,\n  \"results\": [\n", LUAJIT_VERSION,
+                 options.seconds, options.blockSize);
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BenchResult &r = results[i];
+        double nsPerFrame = r.frames ? r.seconds * 1e9 / r.frames : 0.0;
+        double framesPerSecond = r.seconds > 0.0 ? r.frames / r.seconds : 0.0;
+        std::fprintf(file,
+                     "    {\"script\": \"%s\", \"sampleRate\": %d, \"mode\": \"%s\", \"ok\": %s, \"framesPerSecond\": %.0f, "
+                     "\"nsPerFrame\": %.2f, \"gcMs\": %.3f, \"allocations\": %zu, \"peakKB\": %zu, \"error\": \"%s\"}%s\n",
+                     jsonEscape(r.script).c_str(), r.sampleRate, r.mode.c_str(), r.ok ? "true" : "false", framesPerSecond,
+                     nsPerFrame, r.gcSeconds * 1e3, r.allocations, r.peakKB, jsonEscape(r.error).c_str(),
+                     i + 1 < results.size() ? "," : "");
+    }
+    std::fprintf(file, "  ]\n}\n");
+    std::fclose(file);
+    return true;
+}
+
+static void printUsage()
+{
+    std::printf("Usage: luabox-bench [options] [script.lua ...]\n"
+                "  --seconds N     Seconds of audio per run (default 10)\n"
+                "  --rates A,B,... Sample rates (default 44100,48000,96000)\n"
+                "  --block N       Block size for `process_block()` and GC steps (default 64)\n"
+                "  --lib DIR       Directory with util.lua and ffi.lua (default res/lua)\n"
+                "  --json PATH     Also write the results as JSON\n"
+                "Without scripts, runs script/examples/*.lua and res/lua/test_*.lua\n");
+}
+
+int main(int argc, char **argv)
+{
+    BenchOptions options;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--seconds" && hasValue)
+            options.seconds = std::atof(argv[++i]);
+        else if (arg == "--block" && hasValue)
+            options.blockSize = std::max(1, std::min(std::atoi(argv[++i]), MAX_BLOCK_SIZE));
+        else if (arg == "--lib" && hasValue)
+            options.libDir = argv[++i];
+        else if (arg == "--json" && hasValue)
+            options.jsonPath = argv[++i];
+        else if (arg == "--rates" && hasValue)
+        {
+            options.sampleRates.clear();
+            for (char *rate = std::strtok(argv[++i], ","); rate; rate = std::strtok(nullptr, ","))
+                options.sampleRates.push_back(std::atoi(rate));
+        }
+        else if (arg == "-h" || arg == "--help")
+        {
+            printUsage();
+            return 0;
+        }
+        else if (arg[0] == '-')
+        {
+            printUsage();
+            return 1;
+        }
+        else
+            options.scripts.push_back(arg);
+    }
+
+    if (options.scripts.empty())
+    {
+        globScripts("script/examples/*.lua", options.scripts);
+        globScripts("res/lua/test_*.lua", options.scripts);
+    }
+
+    LuaScript::logHandler = logMessage;
+
+    std::vector<BenchResult> results;
+    std::printf("%-32s %6s %-13s %12s %10s %9s %8s %8s\n", "script", "rate", "mode", "frames/s", "ns/frame", "gc ms", "allocs",
+                "peak KB");
+    for (const std::string &path : options.scripts)
+    {
+        for (int sampleRate : options.sampleRates)
+        {
+            BenchResult r = runBench(options, path, sampleRate);
+            results.push_back(r);
+
+            if (r.mode.empty())
+            {
+                std::printf("%-32s %6d error: %s\n", baseName(path).c_str(), sampleRate, r.error.c_str());
+                continue;
+            }
+            std::printf("%-32s %6d %-13s %12.0f %10.1f %9.2f %8zu %8zu%s\n", baseName(path).c_str(), sampleRate, r.mode.c_str(),
+                        r.seconds > 0.0 ? r.frames / r.seconds : 0.0, r.frames ? r.seconds * 1e9 / r.frames : 0.0,
+                        r.gcSeconds * 1e3, r.allocations, r.peakKB, r.ok ? "" : " (runtime error)");
+        }
+    }
+
+    if (!options.jsonPath.empty() && !writeJson(options.jsonPath, options, results))
+    {
+        std::fprintf(stderr, "Could not write %s\n", options.jsonPath.c_str());
+        return 1;
+    }
+    return 0;
+}
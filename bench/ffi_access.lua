@@ -0,0 +1,147 @@
+--[[
+ffi_access.lua - Block accessor micro-benchmark
+
+Compares the legacy metatable proxies with the FFI metatype views in res/lua/ffi.lua,
+both per array access and per process() call of the example scripts.
+
+Run from the repository root after `make dep`:
+    lib/LuaJIT/src/luajit bench/ffi_access.lua [iterations]
+]]
+
+local ffi = require("ffi")
+
+local iterations = tonumber(arg and arg[1]) or 1000000
+
+dofile("res/lua/util.lua")
+dofile("res/lua/ffi.lua")
+local cast_views = _castBlock
+
+-- Legacy proxy implementation, kept here only as the baseline
+local function cast_proxies(b)
+    local raw = ffi.cast("struct LuaProcessBlock*", b)
+
+    local function arr_get(arr, i, name)
+        if i < 1 or i > 8 then error("Array index out of bounds: " .. name .. "[" .. i .. "]") end
+        return arr[i - 1]
+    end
+    local function arr_set(arr, i, v, name)
+        if i < 1 or i > 8 then error("Array index out of bounds: " .. name .. "[" .. i .. "]") end
+        arr[i - 1] = v
+    end
+    local function light_get(arr, i, j, name)
+        if i < 1 or i > 8 or j > 3 then error("Light index out of bounds: " .. name .. "[" .. i .. "]") end
+        return arr[i - 1][j]
+    end
+    local function light_set(arr, i, j, v, name)
+        if i < 1 or i > 8 or j > 3 then error("Light index out of bounds: " .. name .. "[" .. i .. "]") end
+        arr[i - 1][j] = v
+    end
+
+    local block = {
+        samplerate = raw.samplerate,
+        sampletime = raw.sampletime,
+        channels = raw.channels,
+        get_frame = function() return tonumber(raw.frame) end,
+        get_input = function(i) return arr_get(raw.input, i, "input") end,
+        set_input = function(i, v) arr_set(raw.input, i, v, "input") end,
+        get_knob = function(i) return arr_get(raw.knob, i, "knob") end,
+        set_knob = function(i, v) arr_set(raw.knob, i, v, "knob") end,
+        get_button = function(i) return arr_get(raw.button, i, "button") end,
+        set_button = function(i, v) arr_set(raw.button, i, v, "button") end,
+        get_output = function(i) return arr_get(raw.output, i, "output") end,
+        set_output = function(i, v) arr_set(raw.output, i, v, "output") end,
+        get_red = function(i) return light_get(raw.light, i, 0, "red") end,
+        set_red = function(i, v) light_set(raw.light, i, 0, v, "red") end,
+        get_green = function(i) return light_get(raw.light, i, 1, "green") end,
+        set_green = function(i, v) light_set(raw.light, i, 1, v, "green") end,
+        get_blue = function(i) return light_get(raw.light, i, 2, "blue") end,
+        set_blue = function(i, v) light_set(raw.light, i, 2, v, "blue") end
+    }
+
+    for _, name in ipairs({"input", "knob", "button", "output", "red", "green", "blue"}) do
+        local get, set = block["get_" .. name], block["set_" .. name]
+        block[name] = setmetatable({}, {
+            __index = function(_, i) return get(i) end,
+            __newindex = function(_, i, v) set(i, v) end
+        })
+    end
+
+    setmetatable(block, {
+        __index = function(_, key)
+            if key == "frame" then return block.get_frame() end
+            return nil
+        end
+    })
+
+    return block
+end
+
+local function new_block()
+    local raw = ffi.new("struct LuaProcessBlock")
+    raw.samplerate = 48000
+    raw.sampletime = 1 / 48000
+    raw.channels = 8
+    raw.blocksize = 64
+    return raw
+end
+
+local function time(f, ...)
+    local start = os.clock()
+    f(...)
+    return os.clock() - start
+end
+
+-- Array access workloads, each touches every row once per iteration
+local workloads = {
+    {"input read", function(block, n)
+        local s = 0
+        for _ = 1, n do
+            for i = 1, 8 do s = s + block.input[i] end
+        end
+        return s
+    end},
+    {"output write", function(block, n)
+        for k = 1, n do
+            for i = 1, 8 do block.output[i] = k end
+        end
+    end},
+    {"light write", function(block, n)
+        for k = 1, n do
+            for i = 1, 8 do block.green[i] = k end
+        end
+    end}
+}
+
+print(string.format("Accessor benchmark, %d iterations", iterations))
+print(string.format("%-32s %12s %12s %8s", "", "proxies", "views", "speedup"))
+
+for _, workload in ipairs(workloads) do
+    local name, f = workload[1], workload[2]
+    local raw = new_block()
+    local before = time(f, cast_proxies(raw), iterations) * 1e9 / (iterations * 8)
+    local after = time(f, cast_views(raw), iterations) * 1e9 / (iterations * 8)
+    print(string.format("%-32s %9.2f ns %9.2f ns %7.1fx", name .. " (per access)", before, after, before / after))
+end
+
+-- Example scripts, run with `block` in their environment
+local examples = {"8sines", "bytebeat", "clipper", "combdelay", "lorenz", "pdvco", "vcf", "xorvco"}
+
+local function run_script(path, block, n)
+    local chunk = assert(loadfile(path))
+    local env = setmetatable({block = block}, {__index = _G})
+    setfenv(chunk, env)
+    chunk()
+    local process = env.process
+    return time(function()
+        for _ = 1, n do process() end
+    end)
+end
+
+local calls = math.max(1, math.floor(iterations / 10))
+for _, name in ipairs(examples) do
+    local path = "script/examples/" .. name .. ".lua"
+    local raw_before, raw_after = new_block(), new_block()
+    local before = run_script(path, cast_proxies(raw_before), calls) * 1e9 / calls
+    local after = run_script(path, cast_views(raw_after), calls) * 1e9 / calls
+    print(string.format("%-32s %9.2f ns %9.2f ns %7.1fx", name .. ".lua (per call)", before, after, before / after))
+end
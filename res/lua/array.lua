@@ -0,0 +1,234 @@
+--[[
+array.lua - Vectorized array kernels
+
+Adds the `array` table to the sandbox. Buffers are contiguous floats allocated by the host in the script's
+memory arena, the kernels run four samples at a time. Arguments can be buffers or the block buffers
+(`block.inputs[i]`, `block.knobs[i]`, `block.outputs[i]`), which hold `block.blocksize` frames.
+Kernels work in place on the first argument over the length of the shortest argument.
+
+    array.new(n, value)          New buffer of n floats, indexed 1 to n, #buf is n
+    array.fill(dst, v)
+    array.copy(dst, src)
+    array.add(dst, src)          dst = dst + src, also sub and mul
+    array.scale(dst, k, c)       dst = dst * k + c
+    array.clamp(dst, lo, hi)
+    array.mix(dst, src, t)       dst = dst + (src - dst) * t
+    array.dot(a, b)              Returns the dot product
+    array.sum(a)
+    array.max_abs(a)
+    array.lookup(dst, tbl, ph)   Reads tbl at phases 0-1 from ph with linear interpolation, wrapping around
+    array.fir(kernel)            FIR filter from a buffer or table of taps, keeps its history between calls
+        :process(dst, src)
+        :reset()
+
+Buffers also have the kernels as methods, buf:add(src) is array.add(buf, src)
+]]
+
+local ffi = require("ffi")
+
+ffi.cdef[[
+    // Scripts get buffers as references to the empty struct, every key goes to the metatype
+    // A pointer would take numeric keys as pointer arithmetic instead
+    struct LuaArrayBuffer {};
+    struct LuaArrayFir;
+
+    // Private view of the buffer header, scripts only see the empty type
+    struct LuaArrayData {
+        float *data;
+        int size;
+    };
+
+    struct LuaArrayApi {
+        void *(*alloc)(void *ud, void *ptr, size_t osize, size_t nsize);
+        void *ud;
+        const struct LuaProcessBlock *block;
+
+        struct LuaArrayBuffer *(*buffer_new)(struct LuaArrayApi *api, int size);
+        void (*buffer_free)(struct LuaArrayBuffer *buffer);
+
+        void (*fill)(float *dst, float value, int n);
+        void (*copy)(float *dst, const float *src, int n);
+        void (*add)(float *dst, const float *src, int n);
+        void (*sub)(float *dst, const float *src, int n);
+        void (*mul)(float *dst, const float *src, int n);
+        void (*scale)(float *dst, float gain, float offset, int n);
+        void (*clamp)(float *dst, float lo, float hi, int n);
+        void (*mix)(float *dst, const float *src, float t, int n);
+        float (*dot)(const float *a, const float *b, int n);
+        float (*sum)(const float *src, int n);
+        float (*max_abs)(const float *src, int n);
+        void (*lookup)(float *dst, const float *table, int size, const float *phase, int n);
+
+        struct LuaArrayFir *(*fir_new)(struct LuaArrayApi *api, const float *kernel, int taps);
+        void (*fir_free)(struct LuaArrayFir *fir);
+        void (*fir_process)(struct LuaArrayFir *fir, float *dst, const float *src, int n);
+        void (*fir_reset)(struct LuaArrayFir *fir);
+    };
+]]
+
+local raw_cast = ffi.cast
+local istype = ffi.istype
+local min = math.min
+
+-- Create the `array` table for a state from the host's function table
+function _createArray(p)
+    local api = raw_cast("struct LuaArrayApi*", p)
+    local raw_block = api.block
+
+    local buffer_type = ffi.typeof("struct LuaArrayBuffer")
+    local view_type = ffi.typeof("struct LuaBoxBufferView")
+    local view_data_ptr = ffi.typeof("struct LuaBoxBufferData*")
+    local data_ptr = ffi.typeof("struct LuaArrayData*")
+
+    -- Resolve a buffer or block buffer view to a pointer and a length
+    local function span(x, level)
+        if istype(buffer_type, x) then
+            local d = raw_cast(data_ptr, x)
+            return d.data, d.size
+        elseif istype(view_type, x) then
+            return raw_cast(view_data_ptr, x).v, raw_block.blocksize
+        end
+        error("expected an array buffer or a block buffer", level + 1)
+    end
+
+    local k_fill, k_copy, k_add, k_sub, k_mul = api.fill, api.copy, api.add, api.sub, api.mul
+    local k_scale, k_clamp, k_mix, k_dot, k_sum = api.scale, api.clamp, api.mix, api.dot, api.sum
+    local k_max_abs, k_lookup = api.max_abs, api.lookup
+
+    local array = {}
+
+    function array.fill(dst, v)
+        local d, n = span(dst, 2)
+        k_fill(d, v, n)
+    end
+
+    function array.copy(dst, src)
+        local d, n = span(dst, 2)
+        local s, m = span(src, 2)
+        k_copy(d, s, min(n, m))
+    end
+
+    function array.add(dst, src)
+        local d, n = span(dst, 2)
+        local s, m = span(src, 2)
+        k_add(d, s, min(n, m))
+    end
+
+    function array.sub(dst, src)
+        local d, n = span(dst, 2)
+        local s, m = span(src, 2)
+        k_sub(d, s, min(n, m))
+    end
+
+    function array.mul(dst, src)
+        local d, n = span(dst, 2)
+        local s, m = span(src, 2)
+        k_mul(d, s, min(n, m))
+    end
+
+    function array.scale(dst, k, c)
+        local d, n = span(dst, 2)
+        k_scale(d, k, c or 0, n)
+    end
+
+    function array.clamp(dst, lo, hi)
+        local d, n = span(dst, 2)
+        k_clamp(d, lo, hi, n)
+    end
+
+    function array.mix(dst, src, t)
+        local d, n = span(dst, 2)
+        local s, m = span(src, 2)
+        k_mix(d, s, t, min(n, m))
+    end
+
+    function array.dot(a, b)
+        local pa, n = span(a, 2)
+        local pb, m = span(b, 2)
+        return k_dot(pa, pb, min(n, m))
+    end
+
+    function array.sum(a)
+        local pa, n = span(a, 2)
+        return k_sum(pa, n)
+    end
+
+    function array.max_abs(a)
+        local pa, n = span(a, 2)
+        return k_max_abs(pa, n)
+    end
+
+    function array.lookup(dst, tbl, phase)
+        local d, n = span(dst, 2)
+        local t, size = span(tbl, 2)
+        local ph, m = span(phase, 2)
+        if size < 1 then error("array.lookup() table is empty", 2) end
+        k_lookup(d, t, size, ph, min(n, m))
+    end
+
+    -- Buffers index from 1 like the block arrays, kernels are available as methods
+    local methods = {}
+    for name, f in pairs(array) do
+        methods[name] = f
+    end
+
+    ffi.metatype("struct LuaArrayBuffer", {
+        __index = function(self, i)
+            local d = raw_cast(data_ptr, self)
+            if type(i) == "number" then
+                if i >= 1 and i <= d.size then return d.data[i - 1] end
+                error("Array index out of bounds: [" .. tostring(i) .. "], expected 1 to " .. d.size, 2)
+            end
+            return methods[i]
+        end,
+        __newindex = function(self, i, x)
+            local d = raw_cast(data_ptr, self)
+            if type(i) == "number" and i >= 1 and i <= d.size then d.data[i - 1] = x return end
+            error("Array index out of bounds: [" .. tostring(i) .. "], expected 1 to " .. d.size, 2)
+        end,
+        __len = function(self)
+            return raw_cast(data_ptr, self).size
+        end
+    })
+
+    local buffer_new, buffer_free = api.buffer_new, api.buffer_free
+
+    function array.new(n, value)
+        if type(n) ~= "number" or n < 1 or n > 2 ^ 26 then
+            error("array.new() size must be 1 to 2^26", 2)
+        end
+        local p = buffer_new(api, n)
+        if p == nil then error("not enough memory for array buffer", 2) end
+        local buf = ffi.gc(p[0], buffer_free)
+        if value and value ~= 0 then
+            k_fill(raw_cast(data_ptr, buf).data, value, n)
+        end
+        return buf
+    end
+
+    local fir_process, fir_reset, fir_free = api.fir_process, api.fir_reset, api.fir_free
+    ffi.metatype("struct LuaArrayFir", {
+        __index = {
+            process = function(self, dst, src)
+                local d, n = span(dst, 2)
+                local s, m = span(src, 2)
+                fir_process(self, d, s, min(n, m))
+            end,
+            reset = function(self) fir_reset(self) end
+        }
+    })
+
+    function array.fir(kernel)
+        local taps = kernel
+        if type(kernel) == "table" then
+            taps = array.new(math.max(#kernel, 1))
+            for i = 1, #kernel do taps[i] = kernel[i] end
+        end
+        local k, n = span(taps, 2)
+        local p = api.fir_new(api, k, n)
+        if p == nil then error("not enough memory for FIR filter", 2) end
+        return ffi.gc(p, fir_free)
+    end
+
+    return array
+end
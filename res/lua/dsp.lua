@@ -0,0 +1,228 @@
+--[[
+dsp.lua - Native DSP objects
+
+Adds the `dsp` table to the sandbox. Objects are allocated by the host in the script's memory arena
+and are freed when Lua collects them, so create them once outside of `process()` when possible.
+Frequencies are in Hz and times in seconds, objects follow the engine sample rate.
+
+    dsp.biquad(mode)              mode is dsp.LOWPASS, HIGHPASS, BANDPASS, NOTCH, PEAK, LOWSHELF, HIGHSHELF or ALLPASS
+        :set(freq, q, gain_db)    gain only applies to PEAK and the shelves
+        :process(x)
+    dsp.svf()                     State variable filter
+        :set(freq, q)
+        :process(x)               Returns the lowpass, then :bandpass() and :highpass() return the other outputs
+    dsp.onepole()
+        :set(freq)
+        :process(x)               Returns the lowpass, then :highpass() returns the highpass
+    dsp.delay(length, interp)     Length in samples, interp is dsp.NEAREST, LINEAR (default) or HERMITE
+        :write(x)
+        :read(delay)              Delay in samples, 1 is the most recently written sample
+        :process(x, delay, fb)    Reads, then writes x plus the delayed sample times fb
+    dsp.osc(wave)                 wave is dsp.SINE, SAW, SQUARE or TRIANGLE, saw and square are band-limited
+        :set(freq)
+        :pulsewidth(width)        0 to 1, square only
+        :process()                Returns -1 to 1 and advances the phase
+    dsp.slew()
+        :set(rise, fall)          Times for a 10 V change, 0 is instant
+        :process(x)
+    dsp.adsr()
+        :set(a, d, s, r)          Sustain level 0 to 1
+        :process(gate)            Gate is high above 0 V, returns 0 to 1
+
+All objects also have :reset()
+]]
+
+local ffi = require("ffi")
+
+ffi.cdef[[
+    struct LuaDspBiquad;
+    struct LuaDspSvf;
+    struct LuaDspOnepole;
+    struct LuaDspDelay;
+    struct LuaDspOsc;
+    struct LuaDspSlew;
+    struct LuaDspAdsr;
+
+    struct LuaDspApi {
+        void *(*alloc)(void *ud, void *ptr, size_t osize, size_t nsize);
+        void *ud;
+        const struct LuaProcessBlock *block;
+
+        void (*free)(void *object);
+
+        struct LuaDspBiquad *(*biquad_new)(struct LuaDspApi *api, int mode);
+        void (*biquad_set)(struct LuaDspBiquad *b, float freq, float q, float gain);
+        float (*biquad_process)(struct LuaDspBiquad *b, float x);
+        void (*biquad_reset)(struct LuaDspBiquad *b);
+
+        struct LuaDspSvf *(*svf_new)(struct LuaDspApi *api);
+        void (*svf_set)(struct LuaDspSvf *s, float freq, float q);
+        float (*svf_process)(struct LuaDspSvf *s, float x);
+        float (*svf_bandpass)(struct LuaDspSvf *s);
+        float (*svf_highpass)(struct LuaDspSvf *s);
+        void (*svf_reset)(struct LuaDspSvf *s);
+
+        struct LuaDspOnepole *(*onepole_new)(struct LuaDspApi *api);
+        void (*onepole_set)(struct LuaDspOnepole *o, float freq);
+        float (*onepole_process)(struct LuaDspOnepole *o, float x);
+        float (*onepole_highpass)(struct LuaDspOnepole *o);
+        void (*onepole_reset)(struct LuaDspOnepole *o);
+
+        struct LuaDspDelay *(*delay_new)(struct LuaDspApi *api, int length, int interpolation);
+        void (*delay_write)(struct LuaDspDelay *d, float x);
+        float (*delay_read)(struct LuaDspDelay *d, float delay);
+        float (*delay_process)(struct LuaDspDelay *d, float x, float delay, float feedback);
+        int (*delay_length)(struct LuaDspDelay *d);
+        void (*delay_reset)(struct LuaDspDelay *d);
+
+        struct LuaDspOsc *(*osc_new)(struct LuaDspApi *api, int wave);
+        void (*osc_set)(struct LuaDspOsc *o, float freq);
+        void (*osc_pulsewidth)(struct LuaDspOsc *o, float width);
+        float (*osc_process)(struct LuaDspOsc *o);
+        void (*osc_reset)(struct LuaDspOsc *o, float phase);
+
+        struct LuaDspSlew *(*slew_new)(struct LuaDspApi *api);
+        void (*slew_set)(struct LuaDspSlew *s, float rise, float fall);
+        float (*slew_process)(struct LuaDspSlew *s, float x);
+        void (*slew_reset)(struct LuaDspSlew *s, float value);
+
+        struct LuaDspAdsr *(*adsr_new)(struct LuaDspApi *api);
+        void (*adsr_set)(struct LuaDspAdsr *a, float attack, float decay, float sustain, float release);
+        float (*adsr_process)(struct LuaDspAdsr *a, float gate);
+        void (*adsr_reset)(struct LuaDspAdsr *a);
+    };
+]]
+
+local raw_cast = ffi.cast
+local gc = ffi.gc
+
+-- Wraps a freshly allocated object, running out of memory is a script error like any other allocation
+local function wrap(api, p)
+    if p == nil then
+        error("not enough memory for dsp object", 3)
+    end
+    return gc(p, api.free)
+end
+
+-- FFI rejects an object of the wrong type passed as `self`, but nil would go through as NULL
+local function methods(t)
+    for name, f in pairs(t) do
+        t[name] = function(self, a, b, c, d)
+            if self == nil then
+                error("dsp method called without an object, use obj:" .. name .. "()", 2)
+            end
+            return f(self, a, b, c, d)
+        end
+    end
+    return t
+end
+
+-- Create the `dsp` table for a state from the host's function table
+function _createDsp(p)
+    local api = raw_cast("struct LuaDspApi*", p)
+
+    local dsp = {
+        LOWPASS = 0, HIGHPASS = 1, BANDPASS = 2, NOTCH = 3, PEAK = 4, LOWSHELF = 5, HIGHSHELF = 6, ALLPASS = 7,
+        NEAREST = 0, LINEAR = 1, HERMITE = 2,
+        SINE = 0, SAW = 1, SQUARE = 2, TRIANGLE = 3
+    }
+
+    -- Methods call straight through the function pointers, so each is one FFI call once compiled
+    local biquad_set, biquad_process, biquad_reset = api.biquad_set, api.biquad_process, api.biquad_reset
+    ffi.metatype("struct LuaDspBiquad", {
+        __index = methods{
+            set = function(self, freq, q, gain) biquad_set(self, freq, q or 0.7071, gain or 0) end,
+            process = function(self, x) return biquad_process(self, x) end,
+            reset = function(self) biquad_reset(self) end
+        }
+    })
+    function dsp.biquad(mode)
+        return wrap(api, api.biquad_new(api, mode or dsp.LOWPASS))
+    end
+
+    local svf_set, svf_process, svf_bandpass, svf_highpass, svf_reset =
+        api.svf_set, api.svf_process, api.svf_bandpass, api.svf_highpass, api.svf_reset
+    ffi.metatype("struct LuaDspSvf", {
+        __index = methods{
+            set = function(self, freq, q) svf_set(self, freq, q or 0.7071) end,
+            process = function(self, x) return svf_process(self, x) end,
+            bandpass = function(self) return svf_bandpass(self) end,
+            highpass = function(self) return svf_highpass(self) end,
+            reset = function(self) svf_reset(self) end
+        }
+    })
+    function dsp.svf()
+        return wrap(api, api.svf_new(api))
+    end
+
+    local onepole_set, onepole_process, onepole_highpass, onepole_reset =
+        api.onepole_set, api.onepole_process, api.onepole_highpass, api.onepole_reset
+    ffi.metatype("struct LuaDspOnepole", {
+        __index = methods{
+            set = function(self, freq) onepole_set(self, freq) end,
+            process = function(self, x) return onepole_process(self, x) end,
+            highpass = function(self) return onepole_highpass(self) end,
+            reset = function(self) onepole_reset(self) end
+        }
+    })
+    function dsp.onepole()
+        return wrap(api, api.onepole_new(api))
+    end
+
+    local delay_write, delay_read, delay_process, delay_length, delay_reset =
+        api.delay_write, api.delay_read, api.delay_process, api.delay_length, api.delay_reset
+    ffi.metatype("struct LuaDspDelay", {
+        __index = methods{
+            write = function(self, x) delay_write(self, x) end,
+            read = function(self, delay) return delay_read(self, delay) end,
+            process = function(self, x, delay, feedback) return delay_process(self, x, delay, feedback or 0) end,
+            length = function(self) return delay_length(self) end,
+            reset = function(self) delay_reset(self) end
+        }
+    })
+    function dsp.delay(length, interpolation)
+        if type(length) ~= "number" or length < 1 or length > 2 ^ 26 then
+            error("dsp.delay() length must be 1 to 2^26 samples", 2)
+        end
+        return wrap(api, api.delay_new(api, length, interpolation or dsp.LINEAR))
+    end
+
+    local osc_set, osc_pulsewidth, osc_process, osc_reset = api.osc_set, api.osc_pulsewidth, api.osc_process, api.osc_reset
+    ffi.metatype("struct LuaDspOsc", {
+        __index = methods{
+            set = function(self, freq) osc_set(self, freq) end,
+            pulsewidth = function(self, width) osc_pulsewidth(self, width) end,
+            process = function(self) return osc_process(self) end,
+            reset = function(self, phase) osc_reset(self, phase or 0) end
+        }
+    })
+    function dsp.osc(wave)
+        return wrap(api, api.osc_new(api, wave or dsp.SINE))
+    end
+
+    local slew_set, slew_process, slew_reset = api.slew_set, api.slew_process, api.slew_reset
+    ffi.metatype("struct LuaDspSlew", {
+        __index = methods{
+            set = function(self, rise, fall) slew_set(self, rise, fall or rise) end,
+            process = function(self, x) return slew_process(self, x) end,
+            reset = function(self, value) slew_reset(self, value or 0) end
+        }
+    })
+    function dsp.slew()
+        return wrap(api, api.slew_new(api))
+    end
+
+    local adsr_set, adsr_process, adsr_reset = api.adsr_set, api.adsr_process, api.adsr_reset
+    ffi.metatype("struct LuaDspAdsr", {
+        __index = methods{
+            set = function(self, a, d, s, r) adsr_set(self, a, d, s, r) end,
+            process = function(self, gate) return adsr_process(self, gate) end,
+            reset = function(self) adsr_reset(self) end
+        }
+    })
+    function dsp.adsr()
+        return wrap(api, api.adsr_new(api))
+    end
+
+    return dsp
+end
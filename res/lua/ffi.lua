@@ -14,7 +14,55 @@ ffi.cdef[[
         float light[8][3];
         bool button[8];
         float output[8];
+        int blocksize;
+        float inputs[8][256];
+        float knobs[8][256];
+        bool buttons[8][256];
+        float outputs[8][256];
+        int inchannels[8];
+        int outchannels[8];
+        float polyinput[8][16];
+        float polyoutput[8][16];
+        float polyinputs[256][8][16];
+        float polyoutputs[256][8][16];
+        float *busin;
+        float *busout;
+        int businchannels;
+        int busoutchannels;
+        float businputs[256][32];
+        float busoutputs[256][32];
     };
+
+    struct LuaJitStats {
+        int enabled;
+        int traces;
+        int aborts;
+        int flushes;
+    };
+
+    // 1-based views over the arrays of the block struct, empty so scripts can't reach the memory behind them
+    // Scripts get references to them, a pointer to a view would take numeric keys as pointer arithmetic
+    struct LuaBoxFloatView {};
+    struct LuaBoxBoolView {};
+    struct LuaBoxIntView {};
+    struct LuaBoxPolyView {};
+    struct LuaBoxColorView {};
+    struct LuaBoxBufferView {};
+    struct LuaBoxBoolBufferView {};
+
+    // Private layouts the views are cast to inside their metamethods
+    struct LuaBoxFloatData { float v[8]; };
+    struct LuaBoxBoolData { bool v[8]; };
+    struct LuaBoxIntData { int v[8]; };
+    struct LuaBoxPolyData { float v[16]; };
+    struct LuaBoxColorData { float v[8][3]; };
+    struct LuaBoxBufferData { float v[256]; };
+    struct LuaBoxBoolBufferData { bool v[256]; };
+
+    // Bus views, a bus view sits on the host's pointer to the current frame
+    struct LuaBoxBusView {};
+    struct LuaBoxBusFrameView {};
+    struct LuaBoxBusFrameData { float v[32]; };
 ]]
 
 -- Direct access to FFI casting
@@ -22,132 +70,213 @@ local raw_cast = ffi.cast
 
 -- Constants for array bounds
 local MAX_INDEX = 8
-local MAX_COLOR = 3
+local MAX_BLOCK = 256
+local MAX_CHANNELS = 16
+local MAX_BUS_CHANNELS = 32
 
--- Safely get / set an element from a 1D array
-local function arr_get(arr, i, name)
-    if i < 1 or i > MAX_INDEX then
-        error("Array index out of bounds: " .. name .. "[" .. i .. "]")
-        return
-    end
-    return arr[i - 1]
+local function index_error(i, max)
+    error("Array index out of bounds: [" .. tostring(i) .. "], expected 1 to " .. max, 3)
 end
 
-local function arr_set(arr, i, v, name)
-    if i < 1 or i > MAX_INDEX then
-        error("Array index out of bounds: " .. name .. "[" .. i .. "]")
-        return
+-- Views are references to empty structs with a metatype, the metamethods check the bounds and index the array through
+-- a private cast. LuaJIT inlines the check and the cast, so every access compiles down to a single load or store
+local function array_view(name, data, max)
+    local data_ptr = ffi.typeof(data .. "*")
+    ffi.metatype(name, {
+        __index = function(t, i)
+            if i >= 1 and i <= max then return raw_cast(data_ptr, t).v[i - 1] end
+            index_error(i, max)
+        end,
+        __newindex = function(t, i, x)
+            if i >= 1 and i <= max then raw_cast(data_ptr, t).v[i - 1] = x return end
+            index_error(i, max)
+        end
+    })
+end
+
+array_view("struct LuaBoxFloatView", "struct LuaBoxFloatData", MAX_INDEX)
+array_view("struct LuaBoxBoolView", "struct LuaBoxBoolData", MAX_INDEX)
+array_view("struct LuaBoxIntView", "struct LuaBoxIntData", MAX_INDEX)
+array_view("struct LuaBoxPolyView", "struct LuaBoxPolyData", MAX_CHANNELS)
+array_view("struct LuaBoxBufferView", "struct LuaBoxBufferData", MAX_BLOCK)
+array_view("struct LuaBoxBoolBufferView", "struct LuaBoxBoolBufferData", MAX_BLOCK)
+
+-- Color views start at the color component, so the component index is always 0
+local color_ptr = ffi.typeof("struct LuaBoxColorData*")
+ffi.metatype("struct LuaBoxColorView", {
+    __index = function(t, i)
+        if i >= 1 and i <= MAX_INDEX then return raw_cast(color_ptr, t).v[i - 1][0] end
+        index_error(i, MAX_INDEX)
+    end,
+    __newindex = function(t, i, x)
+        if i >= 1 and i <= MAX_INDEX then raw_cast(color_ptr, t).v[i - 1][0] = x return end
+        index_error(i, MAX_INDEX)
+    end
+})
+
+-- Bus views follow the host's pointer, so they always see the current frame without exposing it
+local frame_ptr = ffi.typeof("float**")
+ffi.metatype("struct LuaBoxBusView", {
+    __index = function(t, c)
+        if c >= 1 and c <= MAX_BUS_CHANNELS then return raw_cast(frame_ptr, t)[0][c - 1] end
+        index_error(c, MAX_BUS_CHANNELS)
+    end,
+    __newindex = function(t, c, x)
+        if c >= 1 and c <= MAX_BUS_CHANNELS then raw_cast(frame_ptr, t)[0][c - 1] = x return end
+        index_error(c, MAX_BUS_CHANNELS)
     end
-    arr[i - 1] = v
+})
+
+array_view("struct LuaBoxBusFrameView", "struct LuaBoxBusFrameData", MAX_BUS_CHANNELS)
+
+-- Cast a pointer to a reference to an empty view, every key goes to the metatype
+local function view(ctype, ptr)
+    return raw_cast(ctype .. "*", ptr)[0]
 end
 
--- Safely get / set an element from the 2D light array
-local function light_get(arr, i, j, name)
-    if i < 1 or i > MAX_INDEX or j > MAX_COLOR then
-        error("Light index out of bounds: " .. name .. "[" .. i .. "]")
-        return 0
+-- Create a table of row views for a 2D array
+local function buffer_rows(ctype, arr)
+    local rows = {}
+    for i = 1, MAX_INDEX do
+        rows[i] = view(ctype, arr[i - 1])
     end
-    return arr[i - 1][j]
+    return rows
+end
+
+-- Create a table of row views for each frame of a polyphonic buffer, indexed as poly[frame][row][channel]
+-- Frames are built on first use, most scripts never touch them
+local function poly_frames(arr)
+    return setmetatable({}, {
+        __index = function(frames, n)
+            if type(n) ~= "number" or n < 1 or n > MAX_BLOCK or n % 1 ~= 0 then index_error(n, MAX_BLOCK) end
+            local rows = buffer_rows("struct LuaBoxPolyView", arr[n - 1])
+            rawset(frames, n, rows)
+            return rows
+        end
+    })
 end
 
-local function light_set(arr, i, j, v, name)
-    if i < 1 or i > MAX_INDEX or j > MAX_COLOR then
-        error("Light index out of bounds: " .. name .. "[" .. i .. "]")
-        return
+-- Create a table of frame views for a bus buffer, indexed as bus[frame][channel]
+local function bus_frames(arr)
+    local frames = {}
+    for n = 1, MAX_BLOCK do
+        frames[n] = view("struct LuaBoxBusFrameView", arr[n - 1])
     end
-    arr[i - 1][j] = v
+    return frames
+end
+
+-- Count trace events for the profiler, the host reads the counters once per block
+-- A script whose hot loop keeps aborting traces is running in the interpreter
+function _attachJitStats(p)
+    local stats = raw_cast("struct LuaJitStats*", p)
+    stats.enabled = jit.status() and 1 or 0
+    jit.attach(function(what)
+        if what == "stop" then
+            stats.traces = stats.traces + 1
+        elseif what == "abort" then
+            stats.aborts = stats.aborts + 1
+        elseif what == "flush" then
+            stats.flushes = stats.flushes + 1
+        end
+    end, "trace")
 end
 
--- Cast a raw pointer to a safe proxy
+-- Cast a raw pointer to a table of safe views
 function _castBlock(b)
     local raw = raw_cast("struct LuaProcessBlock*", b)
 
-    -- Table with direct field and safe array access
+    local input = view("struct LuaBoxFloatView", raw.input)
+    local knob = view("struct LuaBoxFloatView", raw.knob)
+    local button = view("struct LuaBoxBoolView", raw.button)
+    local output = view("struct LuaBoxFloatView", raw.output)
+
+    -- Metatable performance on 2D arrays is bad so use 1D lookups instead
+    local red = view("struct LuaBoxColorView", raw.light[0] + 0)
+    local green = view("struct LuaBoxColorView", raw.light[0] + 1)
+    local blue = view("struct LuaBoxColorView", raw.light[0] + 2)
+
+    -- Table with direct field and view access
     local block = {
         -- Basic fields
         samplerate = raw.samplerate,
         sampletime = raw.sampletime,
         channels = raw.channels,
 
-        -- Frame accessor function (convert int64_t to Lua number)
-        get_frame = function() return tonumber(raw.frame) end,
+        -- Arrays
+        input = input,
+        knob = knob,
+        button = button,
+        output = output,
+        red = red,
+        green = green,
+        blue = blue,
 
-        -- Safe accessors for arrays
-        get_input = function(i) return arr_get(raw.input, i, "input") end,
-        set_input = function(i, v) arr_set(raw.input, i, v, "input") end,
+        -- Block buffers for `process_block(n)`, indexed as buffer[row][frame]
+        inputs = buffer_rows("struct LuaBoxBufferView", raw.inputs),
+        knobs = buffer_rows("struct LuaBoxBufferView", raw.knobs),
+        buttons = buffer_rows("struct LuaBoxBoolBufferView", raw.buttons),
+        outputs = buffer_rows("struct LuaBoxBufferView", raw.outputs),
 
-        get_knob = function(i) return arr_get(raw.knob, i, "knob") end,
-        set_knob = function(i, v) arr_set(raw.knob, i, v, "knob") end,
+        -- Polyphonic ports, each row is a contiguous float[16], indexed as poly[row][channel]
+        inchannels = view("struct LuaBoxIntView", raw.inchannels),
+        outchannels = view("struct LuaBoxIntView", raw.outchannels),
+        polyinput = buffer_rows("struct LuaBoxPolyView", raw.polyinput),
+        polyoutput = buffer_rows("struct LuaBoxPolyView", raw.polyoutput),
+        polyinputs = poly_frames(raw.polyinputs),
+        polyoutputs = poly_frames(raw.polyoutputs),
 
-        get_button = function(i) return arr_get(raw.button, i, "button") end,
-        set_button = function(i, v) arr_set(raw.button, i, v, "button") end,
+        -- Expander bus to adjacent LuaBoxes, indexed as busin[channel] or businputs[frame][channel] in block mode
+        busin = view("struct LuaBoxBusView", raw_cast("char*", raw) + ffi.offsetof("struct LuaProcessBlock", "busin")),
+        busout = view("struct LuaBoxBusView", raw_cast("char*", raw) + ffi.offsetof("struct LuaProcessBlock", "busout")),
+        businputs = bus_frames(raw.businputs),
+        busoutputs = bus_frames(raw.busoutputs),
 
-        get_output = function(i) return arr_get(raw.output, i, "output") end,
-        set_output = function(i, v) arr_set(raw.output, i, v, "output") end,
-
-        -- Color component accessors (using correct index order)
-        get_red = function(i) return light_get(raw.light, i, 0, "red") end,
-        set_red = function(i, v) light_set(raw.light, i, 0, v, "red") end,
-
-        get_green = function(i) return light_get(raw.light, i, 1, "green") end,
-        set_green = function(i, v) light_set(raw.light, i, 1, v, "green") end,
-
-        get_blue = function(i) return light_get(raw.light, i, 2, "blue") end,
-        set_blue = function(i, v) light_set(raw.light, i, 2, v, "blue") end
-    }
+        -- Frame accessor function (convert int64_t to Lua number)
+        get_frame = function() return tonumber(raw.frame) end,
 
-    -- Create sparse metatables for direct access to the struct
-    block.input = setmetatable({}, {
-        __index = function(_, i) return block.get_input(i) end,
-        __newindex = function(_, i, v) block.set_input(i, v) end,
-        __metatable = true
-    })
+        -- Accessor functions kept for older scripts
+        get_input = function(i) return input[i] end,
+        set_input = function(i, v) input[i] = v end,
 
-    block.knob = setmetatable({}, {
-        __index = function(_, i) return block.get_knob(i) end,
-        __newindex = function(_, i, v) block.set_knob(i, v) end,
-        __metatable = true
-    })
+        get_knob = function(i) return knob[i] end,
+        set_knob = function(i, v) knob[i] = v end,
 
-    block.button = setmetatable({}, {
-        __index = function(_, i) return block.get_button(i) end,
-        __newindex = function(_, i, v) block.set_button(i, v) end,
-        __metatable = true
-    })
+        get_button = function(i) return button[i] end,
+        set_button = function(i, v) button[i] = v end,
 
-    block.output = setmetatable({}, {
-        __index = function(_, i) return block.get_output(i) end,
-        __newindex = function(_, i, v) block.set_output(i, v) end,
-        __metatable = true
-    })
+        get_output = function(i) return output[i] end,
+        set_output = function(i, v) output[i] = v end,
 
-    -- Metatable performance on 2D arrays is bad so use 1D lookups instead
-    block.red = setmetatable({}, {
-        __index = function(_, i) return block.get_red(i) end,
-        __newindex = function(_, i, v) block.set_red(i, v) end,
-        __metatable = true
-    })
+        get_red = function(i) return red[i] end,
+        set_red = function(i, v) red[i] = v end,
 
-    block.green = setmetatable({}, {
-        __index = function(_, i) return block.get_green(i) end,
-        __newindex = function(_, i, v) block.set_green(i, v) end,
-        __metatable = true
-    })
+        get_green = function(i) return green[i] end,
+        set_green = function(i, v) green[i] = v end,
 
-    block.blue = setmetatable({}, {
-        __index = function(_, i) return block.get_blue(i) end,
-        __newindex = function(_, i, v) block.set_blue(i, v) end,
-        __metatable = true
-    })
+        get_blue = function(i) return blue[i] end,
+        set_blue = function(i, v) blue[i] = v end
+    }
 
     -- Special case: `block.frame` is int64_t so convert to number
+    -- `block.blocksize` can change between blocks so it is read from the struct
+    -- The bus channel counts live in the struct, where the host reads and writes them
     setmetatable(block, {
         __index = function(_, key)
-            if key == "frame" then return block.get_frame() end
+            if key == "frame" then return tonumber(raw.frame) end
+            if key == "blocksize" then return raw.blocksize end
+            if key == "businchannels" then return raw.businchannels end
+            if key == "busoutchannels" then return raw.busoutchannels end
             return nil
         end,
+        __newindex = function(t, key, value)
+            if key == "busoutchannels" then
+                raw.busoutchannels = value
+                return
+            end
+            rawset(t, key, value)
+        end,
         __metatable = true
     })
 
     return block
-end
\ No newline at end of file
+end
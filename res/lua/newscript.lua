@@ -15,6 +15,48 @@ Outputs
     block.red[1-8]:    Red LED values (ranges from 0 to 1)
     block.green[1-8]:  Green LED values (ranges from 0 to 1)
     block.blue[1-8]:   Blue LED values (ranges from 0 to 1)
+Polyphony
+    block.inchannels[1-8]:       Number of channels on each input port
+    block.polyinput[1-8][1-16]:  Input port channels
+    block.outchannels[1-8]:      Number of output channels, 0 sends block.output[i] as mono
+    block.polyoutput[1-8][1-16]: Output port channels
+Block mode
+    Define `process_block(n)` instead of `process()` to run once every n frames
+    block.blocksize:         Number of frames in the current block (n)
+    block.inputs[1-8][1-n]:  Input port buffers
+    block.knobs[1-8][1-n]:   Knob value buffers
+    block.buttons[1-8][1-n]: Button state buffers
+    block.outputs[1-8][1-n]: Output port buffers
+    block.polyinputs[1-n][1-8][1-16]:  Input port channels of each frame
+    block.polyoutputs[1-n][1-8][1-16]: Output port channels of each frame, block.polyoutput is not sent in block mode
+    block.polyinput holds the last frame of each block
+Control rate (context menu, every 16-256 samples)
+    Define `control()` to handle knobs, buttons and lights at the control rate, it runs before `process()`
+    Knobs and buttons are read and lights are written at this rate, knobs ramp in between with "Smooth knobs"
+    In block mode `control()` runs at most once per block
+Oversampling (context menu, 2x/4x/8x)
+    block.samplerate, block.sampletime and block.frame are at the oversampled rate
+    Inputs and outputs are resampled, including polyphonic channels, the bus is not
+Expander bus (LuaBoxes placed side by side, left to right)
+    block.businchannels:            Number of channels sent by the LuaBox on the left, 0 without one
+    block.busoutchannels:           Number of channels to send to the LuaBox on the right (0 to 32)
+    block.busin[1-32]:              Bus input channels of the current frame
+    block.busout[1-32]:             Bus output channels of the current frame, write every channel you send on every frame
+    block.businputs[1-n][1-32]:     Bus input frames in block mode
+    block.busoutputs[1-n][1-32]:    Bus output frames in block mode
+Native DSP objects (see res/lua/dsp.lua)
+    dsp.biquad(mode), dsp.svf(), dsp.onepole(), dsp.delay(length, interp), dsp.osc(wave), dsp.slew(), dsp.adsr()
+    local lp = dsp.svf()  lp:set(1000, 0.7)  block.output[1] = lp:process(block.input[1])
+Array kernels (see res/lua/array.lua)
+    array.new(n), array.add/sub/mul/scale/clamp/mix/copy/fill, array.dot/sum/max_abs, array.lookup, array.fir(kernel)
+    Block buffers can be used directly: array.copy(block.outputs[1], block.inputs[1])
+Samples (see res/lua/sample.lua)
+    local s = sample.load("kick.wav")  Loads a WAV file next to the script on a worker thread
+    s.ready, s.length, s.channels, s.samplerate, s:get(n, c), s:lookup(phase, c)
+Logging
+    print(...), log.debug(...), log.info(...), log.warn(...)
+    Arguments are joined with tabs into one line, shown in the editor console and written to Rack's log
+    Up to 100 lines per second, lines longer than 239 characters are cut
 ]]
 
 
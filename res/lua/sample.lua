@@ -0,0 +1,106 @@
+--[[
+sample.lua - WAV samples and wavetables
+
+Adds the `sample` table to the sandbox. Files are decoded by the host on a worker thread into buffers
+outside of the Lua heap, so loading a large file doesn't count against the memory limit or hold up the audio.
+A sample is empty until it has loaded, load it at the top of the script and check `s.ready` where it matters.
+
+    sample.load(path)       Starts loading a WAV file, the path is relative to the script's folder
+    s.ready                 true once the sample has loaded
+    s.failed                true when the file couldn't be read, the reason is in the log
+    s.length                Number of frames, 0 until ready
+    s.channels
+    s.samplerate
+    s:get(n, c)             Frame n (1 to s.length) of channel c (default 1), 0 outside the sample
+    s:lookup(phase, c)      Reads at phase 0-1 with linear interpolation, wrapping around, for wavetables
+
+Samples are read-only, up to 64 can be loaded per script.
+]]
+
+local ffi = require("ffi")
+
+ffi.cdef[[
+    // Scripts only see the opaque type, the methods read through the private layout
+    struct LuaSample;
+    struct LuaSampleData {
+        const float *data;
+        int length;
+        int channels;
+        int stride;
+        float samplerate;
+        int status;
+    };
+
+    struct LuaSampleApi {
+        struct LuaSample *(*load)(struct LuaSampleApi *api, const char *path);
+    };
+]]
+
+local raw_cast = ffi.cast
+local floor = math.floor
+
+local READY, FAILED = 1, 2
+
+-- Create the `sample` table for a state from the host's function table
+function _createSample(p)
+    local api = raw_cast("struct LuaSampleApi*", p)
+
+    local data_ptr = ffi.typeof("const struct LuaSampleData*")
+
+    local methods = {
+        get = function(s, n, c)
+            local d = raw_cast(data_ptr, s)
+            c = floor(c or 1)
+            if n >= 1 and n <= d.length and c >= 1 and c <= d.channels then
+                return d.data[(c - 1) * d.stride + floor(n) - 1]
+            end
+            return 0
+        end,
+
+        lookup = function(s, phase, c)
+            local d = raw_cast(data_ptr, s)
+            c = floor(c or 1)
+            local length = d.length
+            -- Written with `not` so a NaN channel or phase fails the check instead of passing it
+            if length == 0 or not (c >= 1 and c <= d.channels) then return 0 end
+            local x = (phase % 1) * length
+            if not (x >= 0 and x < length) then x = 0 end
+            local i = floor(x)
+            local t = x - i
+            local base = (c - 1) * d.stride
+            local a = d.data[base + i]
+            local b = d.data[base + (i + 1 < length and i + 1 or 0)]
+            return a + (b - a) * t
+        end
+    }
+
+    ffi.metatype("struct LuaSample", {
+        __index = function(s, key)
+            local d = raw_cast(data_ptr, s)
+            if key == "ready" then return d.status == READY end
+            if key == "failed" then return d.status == FAILED end
+            if key == "length" then return d.length end
+            if key == "channels" then return d.channels end
+            if key == "samplerate" then return d.samplerate end
+            return methods[key]
+        end,
+        __newindex = function(_, key)
+            error("samples are read-only: " .. tostring(key), 2)
+        end
+    })
+
+    local sample = {}
+
+    -- Paths stay inside the script's folder
+    function sample.load(path)
+        if type(path) ~= "string" or path == "" then error("expected a file name", 2) end
+        if path:find("^[/\\]") or path:find("^%a:") or ("/" .. path .. "/"):find("[/\\]%.%.[/\\]") then
+            error("sample paths must be relative to the script's folder: " .. path, 2)
+        end
+        local s = api.load(api, path)
+        if s == nil then error("too many samples or path too long: " .. path, 2) end
+        return s
+    end
+
+    return sample
+end
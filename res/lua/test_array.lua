@@ -0,0 +1,58 @@
+--[[
+test_array.lua - Test array kernels on block buffers
+
+Input 1:   Signal in
+Output 1:  Input through a 5 tap moving average FIR
+Output 2:  Input scaled by knob 1 and clamped to +-5 V
+Output 3:  Sine from a wavetable lookup at 1 Hz per block
+LEDs[1-3]: Green when the kernels agree with plain Lua, red otherwise
+LED 4:     Green when NaN and inf phases read the start of the wavetable
+]]
+
+local fir = array.fir({0.2, 0.2, 0.2, 0.2, 0.2})
+local wavetable = array.new(512)
+for i = 1, #wavetable do
+    wavetable[i] = math.sin(2 * math.pi * (i - 1) / #wavetable)
+end
+local phase = array.new(256)
+local position = 0
+
+-- Phases a runaway accumulator or 0/0 can produce
+local bad = array.new(4)
+bad[1], bad[2], bad[3], bad[4] = 0 / 0, math.huge, -math.huge, 0.25
+local badOut = array.new(4)
+array.lookup(badOut, wavetable, bad)
+local badOk = badOut[1] == wavetable[1] and badOut[2] == wavetable[1] and badOut[3] == wavetable[1]
+    and math.abs(badOut[4] - 1) < 1e-3
+
+local function check(ok, i)
+    block.green[i] = ok and 1 or 0
+    block.red[i] = ok and 0 or 1
+end
+
+function process_block(n)
+    local input = block.inputs[1]
+
+    fir:process(block.outputs[1], input)
+
+    array.copy(block.outputs[2], input)
+    array.scale(block.outputs[2], block.knob[1])
+    array.clamp(block.outputs[2], -5, 5)
+
+    for k = 1, n do
+        phase[k] = position + (k - 1) * block.sampletime
+    end
+    position = (position + n * block.sampletime) % 1
+    array.lookup(block.outputs[3], wavetable, phase)
+
+    -- Compare against plain Lua
+    local sum, dot = 0, 0
+    for k = 1, n do
+        sum = sum + input[k]
+        dot = dot + input[k] * input[k]
+    end
+    check(math.abs(array.sum(input) - sum) < 1e-3, 1)
+    check(math.abs(array.dot(input, input) - dot) < 1e-2, 2)
+    check(array.max_abs(block.outputs[2]) <= 5, 3)
+    check(badOk, 4)
+end
@@ -0,0 +1,19 @@
+--[[
+test_block.lua - Test block mode buffers
+
+Inputs[1-8]:  Passed through to outputs, scaled by knobs
+Buttons[1-8]: Inverts the output while held
+LEDs[1-8]:    Green when the block size matches n
+]]
+
+function process_block(n)
+    for i = 1, block.channels do
+        local input, knob, button, output = block.inputs[i], block.knobs[i], block.buttons[i], block.outputs[i]
+        for k = 1, n do
+            local gain = button[k] and -1 or 1
+            output[k] = input[k] * knob[k] * gain
+        end
+        block.green[i] = (block.blocksize == n) and 1 or 0
+        block.red[i] = (block.blocksize == n) and 0 or 1
+    end
+end
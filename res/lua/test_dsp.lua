@@ -0,0 +1,36 @@
+--[[
+test_dsp.lua - Test that dsp methods only accept their own objects
+
+Input 1:   Signal in
+Output 1:  Input through a lowpass biquad at 1 kHz
+Output 2:  Input delayed by 100 samples
+LED 1:     Green when a delay method called on a block buffer raises an error
+LED 2:     Green when a biquad method called on an array buffer raises an error
+LED 3:     Green when a biquad method called on a delay raises an error
+LED 4:     Green when a method called without an object raises an error
+]]
+
+local lowpass = dsp.biquad(dsp.LOWPASS)
+lowpass:set(1000, 0.7071)
+local delay = dsp.delay(100)
+
+-- Calls with the wrong `self` must fail instead of writing through another object's memory
+local checks = {
+    not pcall(delay.write, block.inputs[1], 1),
+    not pcall(lowpass.set, array.new(4), 1000, 0.7071),
+    not pcall(lowpass.process, delay, 1),
+    not pcall(lowpass.reset, nil)
+}
+
+function process_block(n)
+    local input, out1, out2 = block.inputs[1], block.outputs[1], block.outputs[2]
+    for k = 1, n do
+        out1[k] = lowpass:process(input[k])
+        out2[k] = delay:process(input[k], 100)
+    end
+
+    for i = 1, #checks do
+        block.green[i] = checks[i] and 1 or 0
+        block.red[i] = checks[i] and 0 or 1
+    end
+end
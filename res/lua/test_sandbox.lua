@@ -64,4 +64,24 @@ for i = 1, #safe - 1 do
     print(safe[i])
 end
 
+local escapes = {
+    function() return block.input.v end,
+    function() return block.input[-100] end,
+    function() block.output[9] = 1 end,
+    function() block.outputs[1][100000] = 1 end,
+    function() return block.red[0] end,
+    function() return block.polyinput[1][17] end,
+    function() return block.busin[33] end,
+    function() return block.businputs[1][0] end,
+    function() return block.input + 1 end
+}
+
+print("Checking block views, every access should fail")
+for i = 1, #escapes do
+    print(pcall(escapes[i]))
+end
+print("Checking block views, these should pass")
+block.output[1] = block.input[8] + block.red[1] + block.polyinput[8][16] + block.busin[32] + block.businputs[256][1]
+print(block.output[1], block.outputs[8][256], block.get_input(1))
+
 function process() end
\ No newline at end of file
@@ -14,19 +14,10 @@ Outputs
 
 ]]
 
-local samplerate, bufferlength = block.samplerate, block.samplerate
-local index = 1
+local bufferlength = block.samplerate
 
--- Initialize delay buffer
-local delaybuffer = {}
-for i = 1, bufferlength do
-    delaybuffer[i] = 0
-end
-
--- Helper function to wrap buffer index
-local function wrap(i)
-    return ((i - 1) % bufferlength) + 1
-end
+-- Native delay line with linear interpolation, one second long
+local delay = dsp.delay(bufferlength, dsp.LINEAR)
 
 function process()
     -- Inputs
@@ -34,31 +25,13 @@ function process()
     local delaytime = math.max(0.01, math.abs(block.knob[1]))
     local feedback = block.knob[2] * 0.7
     local mix = (block.knob[3] + 1) * 0.5 -- Negative mix acts like a combfilter, not a bug but a feature
-    
-    -- Delay length in samples
-    local delaysamples = math.floor(delaytime * bufferlength)
-    if delaysamples < 1 then delaysamples = 1 end  -- Prevent zero delay
-    
-    -- Calculate read index
-    local readindex = wrap(index - delaysamples)
-    
-    -- Integer part and fractional part for interpolation
-    local i1 = math.floor(readindex)
-    local i2 = wrap(i1 + 1)
-    local frac = readindex - i1
-    
-    -- Linear interpolation
-    local delayed = (1 - frac) * delaybuffer[i1] + frac * delaybuffer[i2]
-    
+
+    -- Read the delayed sample and write input + feedback into the buffer
+    local delayed = delay:process(input, delaytime * bufferlength, feedback)
+
     -- Delay out with mix control
     block.output[1] = input * (1 - mix) + delayed * mix
-    
+
     -- Inverted output for combfilter effect
     block.output[2] = input * (1 - mix) + -delayed * mix
-    
-    -- Write input + feedback into buffer
-    delaybuffer[index] = input + delayed * feedback
-    
-    -- Increment and wrap index
-    index = wrap(index + 1)
-end
\ No newline at end of file
+end
@@ -0,0 +1,30 @@
+--[[
+polysines.lua - Polyphonic sine wave VCO
+
+Input 1:  Polyphonic V/Oct pitch control
+Knob 1:   Pitch offset (V/Oct)
+Output 1: Polyphonic sine oscillators, one per input channel
+]]
+
+-- Init
+local TWO_PI = 2 * math.pi
+local MID_C = 261.6256
+
+local phase = {}
+for c = 1, 16 do
+    phase[c] = 0
+end
+
+function process()
+    local channels = math.max(block.inchannels[1], 1)
+    local pitch, out = block.polyinput[1], block.polyoutput[1]
+    block.outchannels[1] = channels
+    for c = 1, channels do
+        -- Calculate frequency based on 1V/octave scaling
+        local freq = MID_C * (2 ^ (pitch[c] + block.knob[1]))
+        -- Generate sine wave and set output
+        out[c] = math.sin(TWO_PI * phase[c]) * 5
+        -- Increment and wrap phase
+        phase[c] = (phase[c] + freq * block.sampletime) % 1
+    end
+end
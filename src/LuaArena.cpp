@@ -0,0 +1,117 @@
+// LuaArena.cpp
+
+#include "LuaArena.hpp"
+#include <cstdlib>
+#include <cstring>
+
+// The region isn't touched here, so a small script only commits the pages it uses
+// Scripts do most of their allocation while loading on a worker, where the first touch of a page is cheap
+LuaArena::LuaArena(size_t capacity)
+{
+    memory = static_cast<char *>(std::malloc(capacity));
+    if (memory)
+        this->capacity = capacity;
+}
+
+LuaArena::~LuaArena() { std::free(memory); }
+
+// Smallest class whose blocks hold `size` bytes and the header
+int LuaArena::sizeClass(size_t size)
+{
+    int c = MIN_CLASS;
+    while (((size_t)1 << c) < size + HEADER_SIZE)
+        c++;
+    return c;
+}
+
+// Size class stored in the header in front of a block handed out to Lua
+int &LuaArena::blockClass(void *ptr)
+{
+    return *reinterpret_cast<int *>(static_cast<char *>(ptr) - HEADER_SIZE);
+}
+
+void *LuaArena::allocate(size_t size)
+{
+    int c = sizeClass(size);
+    if (c >= NUM_CLASSES)
+        return nullptr;
+
+    // Reuse a freed block of the same class
+    char *block = static_cast<char *>(freeLists[c]);
+    if (block)
+    {
+        freeLists[c] = *reinterpret_cast<void **>(block);
+    }
+    else if (top + ((size_t)1 << c) <= capacity)
+    {
+        block = memory + top;
+        top += (size_t)1 << c;
+    }
+    else
+    {
+        // Out of fresh space, take a larger free block, its header keeps the larger class
+        for (int larger = c + 1; larger < NUM_CLASSES && !block; larger++)
+        {
+            block = static_cast<char *>(freeLists[larger]);
+            if (block)
+            {
+                freeLists[larger] = *reinterpret_cast<void **>(block);
+                c = larger;
+            }
+        }
+        if (!block)
+        {
+            exhausted = true;
+            return nullptr;
+        }
+    }
+
+    used += (size_t)1 << c;
+    allocations++;
+    if (used > peak.load(std::memory_order_relaxed))
+        peak.store(used, std::memory_order_relaxed);
+    void *ptr = block + HEADER_SIZE;
+    blockClass(ptr) = c;
+    return ptr;
+}
+
+void LuaArena::release(void *ptr)
+{
+    int c = blockClass(ptr);
+    char *block = static_cast<char *>(ptr) - HEADER_SIZE;
+    *reinterpret_cast<void **>(block) = freeLists[c];
+    freeLists[c] = block;
+    used -= (size_t)1 << c;
+}
+
+void *LuaArena::alloc(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+    LuaArena *arena = static_cast<LuaArena *>(ud);
+
+    if (nsize == 0)
+    {
+        if (ptr)
+            arena->release(ptr);
+        return nullptr;
+    }
+
+    if (!ptr)
+        return arena->allocate(nsize);
+
+    // Blocks already have room up to their class size
+    if (sizeClass(nsize) == blockClass(ptr))
+        return ptr;
+
+    void *block = arena->allocate(nsize);
+    if (!block)
+    {
+        // Shrinking must not fail, the block keeps its class and is freed into it later
+        if (nsize < osize)
+            return ptr;
+        return nullptr;
+    }
+
+    std::memcpy(block, ptr, nsize < osize ? nsize : osize);
+    arena->release(ptr);
+    return block;
+}
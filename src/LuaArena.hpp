@@ -0,0 +1,51 @@
+// LuaArena.hpp
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+// Allocator for one Lua state, carving power-of-two blocks out of a region reserved up front
+// Freed blocks go to per-size free lists, so allocating on the audio thread never calls malloc or locks
+// Each block starts with a header holding its size class, so a block always returns to the list it came from,
+// even when it was taken from a larger class or kept through a failed shrink
+struct LuaArena
+{
+    static constexpr int MIN_CLASS = 5; // 32 bytes, header included
+    static constexpr int NUM_CLASSES = 48;
+    static constexpr size_t HEADER_SIZE = 16; // keeps the 16 byte alignment of the blocks
+
+    // Reserves `capacity` bytes, the pages are only committed when the script first uses them
+    explicit LuaArena(size_t capacity);
+    ~LuaArena();
+
+    // `lua_Alloc` compatible entry point, `ud` is the arena
+    static void *alloc(void *ud, void *ptr, size_t osize, size_t nsize);
+
+    size_t getCapacity() const { return capacity; }
+
+    // Bytes of the blocks handed out to Lua right now, headers included, and the most ever handed out at once
+    size_t getUsed() const { return used; }
+    size_t getPeak() const { return peak.load(std::memory_order_relaxed); }
+
+    // Number of blocks handed out, including reallocations that moved
+    size_t getAllocations() const { return allocations; }
+
+    // Set when an allocation was refused because the arena was full
+    bool isExhausted() const { return exhausted; }
+
+  private:
+    char *memory = nullptr;
+    size_t capacity = 0;
+    size_t top = 0;
+    size_t used = 0;
+    size_t allocations = 0;
+    std::atomic<size_t> peak{0};
+    bool exhausted = false;
+    void *freeLists[NUM_CLASSES] = {};
+
+    void *allocate(size_t size);
+    void release(void *ptr);
+    static int sizeClass(size_t size);
+    static int &blockClass(void *ptr);
+};
@@ -0,0 +1,249 @@
+// LuaArray.cpp
+
+#include "LuaArray.hpp"
+#include <simd/Vector.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using rack::simd::float_4;
+
+// Kernels run four lanes at a time with unaligned loads, then finish the tail with scalar code
+
+static void array_fill(float *dst, float value, int n)
+{
+    float_4 v(value);
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+        v.store(dst + i);
+    for (; i < n; i++)
+        dst[i] = value;
+}
+
+static void array_copy(float *dst, const float *src, int n) { std::memmove(dst, src, n * sizeof(float)); }
+
+static void array_add(float *dst, const float *src, int n)
+{
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+        (float_4::load(dst + i) + float_4::load(src + i)).store(dst + i);
+    for (; i < n; i++)
+        dst[i] += src[i];
+}
+
+static void array_sub(float *dst, const float *src, int n)
+{
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+        (float_4::load(dst + i) - float_4::load(src + i)).store(dst + i);
+    for (; i < n; i++)
+        dst[i] -= src[i];
+}
+
+static void array_mul(float *dst, const float *src, int n)
+{
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+        (float_4::load(dst + i) * float_4::load(src + i)).store(dst + i);
+    for (; i < n; i++)
+        dst[i] *= src[i];
+}
+
+static void array_scale(float *dst, float gain, float offset, int n)
+{
+    float_4 g(gain), o(offset);
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+        (float_4::load(dst + i) * g + o).store(dst + i);
+    for (; i < n; i++)
+        dst[i] = dst[i] * gain + offset;
+}
+
+static void array_clamp(float *dst, float lo, float hi, int n)
+{
+    float_4 l(lo), h(hi);
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+        rack::simd::fmin(rack::simd::fmax(float_4::load(dst + i), l), h).store(dst + i);
+    for (; i < n; i++)
+        dst[i] = std::min(std::max(dst[i], lo), hi);
+}
+
+static void array_mix(float *dst, const float *src, float t, int n)
+{
+    float_4 t4(t);
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        float_4 a = float_4::load(dst + i);
+        (a + (float_4::load(src + i) - a) * t4).store(dst + i);
+    }
+    for (; i < n; i++)
+        dst[i] += (src[i] - dst[i]) * t;
+}
+
+static float horizontalSum(float_4 v) { return v[0] + v[1] + v[2] + v[3]; }
+
+static float array_dot(const float *a, const float *b, int n)
+{
+    float_4 acc(0.f);
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+        acc += float_4::load(a + i) * float_4::load(b + i);
+    float sum = horizontalSum(acc);
+    for (; i < n; i++)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+static float array_sum(const float *src, int n)
+{
+    float_4 acc(0.f);
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+        acc += float_4::load(src + i);
+    float sum = horizontalSum(acc);
+    for (; i < n; i++)
+        sum += src[i];
+    return sum;
+}
+
+static float array_max_abs(const float *src, int n)
+{
+    float_4 acc(0.f);
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+        acc = rack::simd::fmax(acc, rack::simd::abs(float_4::load(src + i)));
+    float m = std::max(std::max(acc[0], acc[1]), std::max(acc[2], acc[3]));
+    for (; i < n; i++)
+        m = std::max(m, std::fabs(src[i]));
+    return m;
+}
+
+// Wavetable read with linear interpolation, the phase wraps to 0-1 over the whole table
+static void array_lookup(float *dst, const float *table, int size, const float *phase, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        // NaN and inf phases come out as NaN here, which would convert to a wild index
+        float p = phase[i] - std::floor(phase[i]);
+        if (!(p >= 0.f && p < 1.f))
+            p = 0.f;
+        float x = p * size;
+        int j = std::min((int)x, size - 1);
+        float t = x - j;
+        float a = table[j];
+        float b = table[j + 1 < size ? j + 1 : 0];
+        dst[i] = a + (b - a) * t;
+    }
+}
+
+static LuaArrayBuffer *buffer_new(LuaArrayApi *api, int size)
+{
+    LuaArrayBuffer *buffer = static_cast<LuaArrayBuffer *>(api->alloc(api->ud, nullptr, 0, sizeof(LuaArrayBuffer)));
+    if (!buffer)
+        return nullptr;
+
+    size_t bytes = std::max(size, 1) * sizeof(float);
+    buffer->data = static_cast<float *>(api->alloc(api->ud, nullptr, 0, bytes));
+    if (!buffer->data)
+    {
+        api->alloc(api->ud, buffer, sizeof(LuaArrayBuffer), 0);
+        return nullptr;
+    }
+    std::memset(buffer->data, 0, bytes);
+    buffer->size = size;
+    buffer->bytes = bytes;
+    buffer->api = api;
+    return buffer;
+}
+
+static void buffer_free(LuaArrayBuffer *buffer)
+{
+    LuaArrayApi *api = buffer->api;
+    api->alloc(api->ud, buffer->data, buffer->bytes, 0);
+    api->alloc(api->ud, buffer, sizeof(LuaArrayBuffer), 0);
+}
+
+static LuaArrayFir *fir_new(LuaArrayApi *api, const float *kernel, int taps)
+{
+    LuaArrayFir *fir = static_cast<LuaArrayFir *>(api->alloc(api->ud, nullptr, 0, sizeof(LuaArrayFir)));
+    if (!fir)
+        return nullptr;
+    fir->kernel = static_cast<float *>(api->alloc(api->ud, nullptr, 0, taps * sizeof(float)));
+    fir->history = static_cast<float *>(api->alloc(api->ud, nullptr, 0, 2 * taps * sizeof(float)));
+    if (!fir->kernel || !fir->history)
+    {
+        if (fir->kernel)
+            api->alloc(api->ud, fir->kernel, taps * sizeof(float), 0);
+        if (fir->history)
+            api->alloc(api->ud, fir->history, 2 * taps * sizeof(float), 0);
+        api->alloc(api->ud, fir, sizeof(LuaArrayFir), 0);
+        return nullptr;
+    }
+
+    // Reversed, so the newest sample lines up with the first tap
+    for (int i = 0; i < taps; i++)
+        fir->kernel[i] = kernel[taps - 1 - i];
+    std::memset(fir->history, 0, 2 * taps * sizeof(float));
+    fir->taps = taps;
+    fir->pos = 0;
+    fir->api = api;
+    return fir;
+}
+
+static void fir_free(LuaArrayFir *fir)
+{
+    LuaArrayApi *api = fir->api;
+    api->alloc(api->ud, fir->kernel, fir->taps * sizeof(float), 0);
+    api->alloc(api->ud, fir->history, 2 * fir->taps * sizeof(float), 0);
+    api->alloc(api->ud, fir, sizeof(LuaArrayFir), 0);
+}
+
+// `dst` and `src` may be the same buffer
+static void fir_process(LuaArrayFir *fir, float *dst, const float *src, int n)
+{
+    int taps = fir->taps;
+    for (int i = 0; i < n; i++)
+    {
+        fir->history[fir->pos] = src[i];
+        fir->history[fir->pos + taps] = src[i];
+        if (++fir->pos == taps)
+            fir->pos = 0;
+        dst[i] = array_dot(fir->kernel, fir->history + fir->pos, taps);
+    }
+}
+
+static void fir_reset(LuaArrayFir *fir)
+{
+    std::memset(fir->history, 0, 2 * fir->taps * sizeof(float));
+    fir->pos = 0;
+}
+
+void initArrayApi(LuaArrayApi &api, void *(*alloc)(void *, void *, size_t, size_t), void *ud, const LuaProcessBlock *block)
+{
+    api.alloc = alloc;
+    api.ud = ud;
+    api.block = block;
+
+    api.buffer_new = buffer_new;
+    api.buffer_free = buffer_free;
+
+    api.fill = array_fill;
+    api.copy = array_copy;
+    api.add = array_add;
+    api.sub = array_sub;
+    api.mul = array_mul;
+    api.scale = array_scale;
+    api.clamp = array_clamp;
+    api.mix = array_mix;
+    api.dot = array_dot;
+    api.sum = array_sum;
+    api.max_abs = array_max_abs;
+    api.lookup = array_lookup;
+
+    api.fir_new = fir_new;
+    api.fir_free = fir_free;
+    api.fir_process = fir_process;
+    api.fir_reset = fir_reset;
+}
@@ -0,0 +1,63 @@
+// LuaArray.hpp
+
+#pragma once
+
+#include <cstddef>
+
+struct LuaProcessBlock;
+
+// Vectorized kernels on float buffers for scripts, called from `res/lua/array.lua` through FFI
+// Like LuaDspApi the functions are handed to Lua as a table of pointers, the layout must match the cdef
+extern "C" {
+
+// Buffer header, the first two fields are also declared in `array.lua`
+struct LuaArrayBuffer
+{
+    float *data;
+    int size;
+    size_t bytes;
+    struct LuaArrayApi *api;
+};
+
+// Stateful FIR filter, the history is stored twice so every output is one contiguous dot product
+struct LuaArrayFir
+{
+    int taps;
+    int pos;
+    float *kernel;
+    float *history;
+    struct LuaArrayApi *api;
+};
+
+struct LuaArrayApi
+{
+    void *(*alloc)(void *ud, void *ptr, size_t osize, size_t nsize);
+    void *ud;
+    const LuaProcessBlock *block;
+
+    LuaArrayBuffer *(*buffer_new)(LuaArrayApi *api, int size);
+    void (*buffer_free)(LuaArrayBuffer *buffer);
+
+    void (*fill)(float *dst, float value, int n);
+    void (*copy)(float *dst, const float *src, int n);
+    void (*add)(float *dst, const float *src, int n);
+    void (*sub)(float *dst, const float *src, int n);
+    void (*mul)(float *dst, const float *src, int n);
+    void (*scale)(float *dst, float gain, float offset, int n);
+    void (*clamp)(float *dst, float lo, float hi, int n);
+    void (*mix)(float *dst, const float *src, float t, int n);
+    float (*dot)(const float *a, const float *b, int n);
+    float (*sum)(const float *src, int n);
+    float (*max_abs)(const float *src, int n);
+    void (*lookup)(float *dst, const float *table, int size, const float *phase, int n);
+
+    LuaArrayFir *(*fir_new)(LuaArrayApi *api, const float *kernel, int taps);
+    void (*fir_free)(LuaArrayFir *fir);
+    void (*fir_process)(LuaArrayFir *fir, float *dst, const float *src, int n);
+    void (*fir_reset)(LuaArrayFir *fir);
+};
+
+} // extern "C"
+
+// Fills the function table for a state using `alloc` and `ud`
+void initArrayApi(LuaArrayApi &api, void *(*alloc)(void *, void *, size_t, size_t), void *ud, const LuaProcessBlock *block);
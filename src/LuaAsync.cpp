@@ -0,0 +1,65 @@
+// LuaAsync.cpp
+
+#include "LuaAsync.hpp"
+#include <algorithm>
+
+LuaAsyncPool &LuaAsyncPool::instance()
+{
+    static LuaAsyncPool pool;
+    return pool;
+}
+
+// One thread per core except the one Rack's engine is most likely on
+LuaAsyncPool::LuaAsyncPool()
+{
+    int numThreads = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+    for (int i = 0; i < numThreads; i++)
+        threads.emplace_back(&LuaAsyncPool::run, this);
+}
+
+LuaAsyncPool::~LuaAsyncPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    available.notify_all();
+    for (std::thread &thread : threads)
+        thread.join();
+}
+
+bool LuaAsyncPool::post(LuaAsyncJob *job)
+{
+    if (!queue.push(job))
+        return false;
+
+    // A thread counts itself as sleeping before it checks the queue for the last time, with the mutex held until
+    // it waits. Either it sees the job, or this sees it sleeping and notifies after it has released the mutex
+    // The mutex is only taken while a thread sleeps and only held for its last check
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping.load(std::memory_order_relaxed) > 0)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        available.notify_one();
+    }
+    return true;
+}
+
+void LuaAsyncPool::run()
+{
+    while (!stopping)
+    {
+        LuaAsyncJob *job;
+        if (queue.pop(job))
+        {
+            job->run();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        sleeping.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        available.wait(lock, [this]() { return stopping || !queue.empty(); });
+        sleeping.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
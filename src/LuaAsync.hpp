@@ -0,0 +1,42 @@
+// LuaAsync.hpp
+
+#pragma once
+
+#include "LuaQueue.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work item for LuaAsyncPool, owned by the poster and reused for every block
+struct LuaAsyncJob
+{
+    virtual ~LuaAsyncJob() {}
+    virtual void run() = 0;
+};
+
+// Pool of threads that run script blocks for the async mode
+// Unlike LuaWorker, posting is safe on the audio thread: jobs go through a LuaQueue
+// and any idle thread takes the next one, so the load spreads over all cores
+struct LuaAsyncPool
+{
+    static LuaAsyncPool &instance();
+
+    // Returns false when the queue is full, the caller then runs the job itself
+    bool post(LuaAsyncJob *job);
+
+    ~LuaAsyncPool();
+
+  private:
+    LuaQueue<LuaAsyncJob *, 256> queue;
+
+    std::mutex mutex;
+    std::condition_variable available;
+    std::atomic<int> sleeping{0};
+    std::atomic<bool> stopping{false};
+    std::vector<std::thread> threads;
+
+    LuaAsyncPool();
+    void run();
+};
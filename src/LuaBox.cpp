@@ -1,10 +1,14 @@
 // LuaBox.cpp
 
 #include "LuaBox.hpp"
+#include <cstring>
+#include <thread>
 
 LuaBox::LuaBox()
 {
     config(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS);
+    leftExpander.producerMessage = &busMessages[0];
+    leftExpander.consumerMessage = &busMessages[1];
     configButton(RELOAD_PARAM, "Reload script");
     configButton(RUN_PARAM, "Toggle engine");
     configLight(OK_LIGHT, "Lua status");
@@ -20,258 +24,248 @@ LuaBox::LuaBox()
 
 LuaBox::~LuaBox()
 {
-    if (L)
-        unloadScript();
+    // Jobs and the watcher callback hold a pointer to this module, so stop them before freeing anything
+    if (watching)
+        LuaWatcher::instance().unwatch(this);
+    jobs.wait();
+    while (asyncJob.busy.load(std::memory_order_acquire))
+        std::this_thread::yield();
+    delete script;
+    delete fadeScript;
+    delete pendingScript.exchange(nullptr);
+    delete retiredScript.exchange(nullptr);
 }
 
-// Custom print that outputs to log.txt
-int LuaBox::lua_sandboxPrint(lua_State *L)
+// Compiles the current script string on a worker thread, the audio thread picks it up when ready
+void LuaBox::loadScript()
 {
-    int n = std::min(lua_gettop(L), 10);
-    for (int i = 1; i <= n; i++)
-    {
-        if (lua_isstring(L, i) || lua_isnumber(L, i))
-            DEBUG(lua_tostring(L, i));
-        else if (lua_isboolean(L, i))
-            DEBUG(lua_toboolean(L, i) ? "true" : "false");
-        else if (lua_istable(L, i))
-            DEBUG("table");
-        else if (lua_isfunction(L, i))
-            DEBUG("function");
-        else if (lua_isnil(L, i))
-            DEBUG("nil");
-        else
-            DEBUG("Lua error: print() only accepts strings, numbers, booleans or nil!");
-    }
-    return 0;
-}
+    INFO("Loading Lua script %s", scriptPath.c_str());
 
-bool LuaBox::createLuaState()
-{
-    if (!(L = luaL_newstate()))
-    {
-        setStatus(STATUS_ERROR, "Lua error: Failed to initialize Lua state");
-        return false;
-    }
+    std::shared_ptr<const ScriptText> text = getScriptText();
+    if (text->source.empty())
+        return;
 
-    // Push and call each library loader for the required libraries in the global environment
-    // clang-format off
-        const std::initializer_list<luaL_Reg> lib_load = {
-            {"", luaopen_base},
-            {LUA_LOADLIBNAME, luaopen_package},
-            {LUA_TABLIBNAME, luaopen_table},
-            {LUA_STRLIBNAME, luaopen_string},
-            {LUA_MATHLIBNAME, luaopen_math},
-            {LUA_BITLIBNAME, luaopen_bit},
-            {LUA_JITLIBNAME, luaopen_jit},
-            {LUA_OSLIBNAME, luaopen_os},
-            {LUA_FFILIBNAME, luaopen_ffi}
-        };
-    // clang-format on
-    for (const auto &lib : lib_load)
+    // Initialize the Lua block parameters with engine values
+    LuaScript *next = new LuaScript();
+    next->memoryLimit = (size_t)memoryLimit << 20;
+    next->deadline = deadline;
+    next->logBuffer = &logBuffer;
+    next->sampleRequests = &sampleRequests;
+    if (!scriptPath.empty())
+        next->sampleDir = system::getDirectory(scriptPath);
+    next->cacheDir = asset::user("LuaBox/cache");
+    system::createDirectories(next->cacheDir);
+    next->oversample = oversample;
+    next->controlInterval = controlDivision * oversample;
+    next->resetBlock(APP->engine->getSampleRate() * oversample, getScriptBlockSize(oversample));
+    next->block.frame = APP->engine->getFrame() * oversample;
+    for (int i = 0; i < NUM_ROWS; i++)
     {
-        lua_pushcfunction(L, lib.func);
-        lua_pushstring(L, lib.name);
-        lua_call(L, 1, 0);
+        if (inputs[LUA_INPUTS + i].isConnected())
+            next->block.input[i] = inputs[LUA_INPUTS + i].getVoltage();
+
+        next->block.knob[i] = params[LUA_KNOBS + i].getValue();
+        for (int n = 0; n < MAX_BLOCK_SIZE; n++)
+            next->block.knobs[i][n] = next->block.knob[i];
     }
 
-    // Create empty sandbox table
-    lua_newtable(L);
+    // Only the most recent request is swapped in, older jobs that finish later are dropped
+    // A load after an unload cancels the unload that the audio thread hasn't handled yet
+    unloadRequested = false;
+    uint64_t generation = ++loadGeneration;
+    std::string chunkName = "=" + (scriptPath.empty() ? std::string("script") : system::getFilename(scriptPath));
+    std::string libDir = asset::plugin(pluginInstance, "res/lua");
+    std::string path = scriptPath;
 
-    // Add custom functions to the sandbox environment
-    lua_pushcfunction(L, lua_sandboxPrint);
-    lua_setfield(L, -2, "print");
+    LuaWorker::instance().post(jobs, [=]() {
+        bool loaded = next->load(text->source, chunkName, libDir);
 
-    // Save `time()` before disabling `os` so that it can be used for `math.randomseed()`
-    lua_getglobal(L, "os");
-    lua_getfield(L, -1, "time");
-    lua_setfield(L, -3, "time");
-    lua_pop(L, 1); // Pop os
+        // The panel collects retired scripts too, but it isn't stepped when it isn't drawn, and a retired script blocks the swap
+        delete retiredScript.exchange(nullptr, std::memory_order_acq_rel);
 
-    // Add allowed standard library tables to the sandbox
-    static constexpr std::array<const char *, 4> allowedLibs = {"math", "string", "table", "bit"};
-    for (const auto &table : allowedLibs)
-    {
-        lua_getglobal(L, table);
-        if (!lua_istable(L, -1))
+        if (!loaded)
         {
-            lua_pop(L, 1); // Pop nil
-            WARN("Lua error: Not a function table: %s", table);
-            continue;
+            if (generation == loadGeneration)
+                postStatus(STATUS_ERROR, next->errorMessage);
+            delete next;
+            return;
         }
-        lua_setfield(L, -2, table);
-    }
 
-    // Add allowed functions to the sandbox
-    static constexpr std::array<const char *, 12> allowedFuncs = {"pairs",    "ipairs",       "unpack", "next",  "type",   "tostring",
-                                                                  "tonumber", "setmetatable", "assert", "pcall", "xpcall", "error"};
-    for (const auto &func : allowedFuncs)
-    {
-        lua_getglobal(L, func);
-        if (lua_isnil(L, -1))
+        if (generation != loadGeneration)
         {
-            lua_pop(L, 1); // Pop nil
-            WARN("Lua function not found: %s", func);
-            continue;
+            delete next;
+            return;
         }
-        lua_setfield(L, -2, func);
-    }
 
-    // Load and run the utility library
-    std::string libPath = asset::plugin(pluginInstance, "res/lua/util.lua");
-    if (luaL_dofile(L, libPath.c_str()))
-    {
+        // The audio thread owns the script once it is pending
+        const char *function = next->blockMode ? "process_block" : "process";
+        const char *origin = next->loadedFromCache ? " from the bytecode cache" : "";
+        delete pendingScript.exchange(next);
+        INFO("Lua script %s loaded%s and `%s` function set", path.c_str(), origin, function);
+    });
 
-        setStatus(STATUS_ERROR, std::string("Lua error loading utility library:\n") + lua_tostring(L, -1));
-        lua_pop(L, 1); // Pop error
-        return false;
-    }
+    collectScripts();
+}
 
-    // Store the sandbox table globally as _SANDBOX for later use
-    lua_pushvalue(L, -1);
-    lua_setglobal(L, "_SANDBOX");
+// Audio thread: swaps in a pending script, or drops the current one after an error or unload
+// A replaced script is parked in `retiredScript` until collectScripts() or the next load job destroys it off the audio thread
+// Whoever takes a script out of `pendingScript` with exchange() owns it, so a script is never freed twice
+void LuaBox::swapScript()
+{
+    // A block running on the async pool still uses the current script
+    if (retiredScript.load(std::memory_order_acquire) || asyncJob.busy.load(std::memory_order_acquire))
+        return;
 
-    // Load and run the FFI file
-    std::string ffiPath = asset::plugin(pluginInstance, "res/lua/ffi.lua");
-    if (luaL_dofile(L, ffiPath.c_str()))
+    // Retire the previous script once the crossfade is over
+    if (fadeScript && fadePos >= fadeLength)
     {
-        setStatus(STATUS_ERROR, std::string("Lua error loading FFI script:\n") + lua_tostring(L, -1));
-        lua_pop(L, 1); // Pop error
-        return false;
+        retiredScript.store(fadeScript, std::memory_order_release);
+        fadeScript = nullptr;
+        return;
     }
 
-    // Disable unsafe functions and modules in the global environment for added safety
-    // clang-format off
-        const std::initializer_list<const char *> unsafeFuncs = {
-            "collectgarbage", "dofile", "getfenv", "getmetatable", "load", "loadfile", "loadstring", "module",
-            "rawequal", "rawget", "rawset", "require", "setfenv", "ffi", "io", "os", "package", "debug", "_G"
-        };
-    // clang-format on
-    lua_getglobal(L, "_G");
-    for (const auto &func : unsafeFuncs)
+    // An unload drops the script waiting to be swapped in first, then the current one
+    if (unloadRequested.load(std::memory_order_acquire))
     {
-        lua_pushnil(L);
-        lua_setfield(L, -2, func);
+        if (LuaScript *pending = pendingScript.exchange(nullptr, std::memory_order_acq_rel))
+        {
+            retiredScript.store(pending, std::memory_order_release);
+            return;
+        }
+        if (script)
+        {
+            retiredScript.store(script, std::memory_order_release);
+            script = nullptr;
+            scriptLoaded = false;
+            fadePos = fadeLength;
+        }
+        unloadRequested.store(false, std::memory_order_relaxed);
+        return;
     }
-    lua_pop(L, 2); // Pop _G (or nil) and sandbox table
-
-    return true;
-}
 
-void LuaBox::loadScript()
-{
-    INFO("Loading Lua script %s", scriptPath.c_str());
-
-    if (scriptString.empty())
+    bool crossfade = crossfadeTime > 0.f && scriptLoaded && scriptRunning;
+    if (!pendingScript.load(std::memory_order_relaxed) || !((crossfade && !asyncActive) || !scriptLoaded || script->blockIndex == 0))
+    {
+        // A script stopped by an error is dropped
+        if (script && !scriptLoaded)
+        {
+            retiredScript.store(script, std::memory_order_release);
+            script = nullptr;
+            fadePos = fadeLength;
+        }
         return;
+    }
 
-    unloadScript();
-
-    if (!createLuaState())
+    LuaScript *next = pendingScript.exchange(nullptr, std::memory_order_acq_rel);
+    if (!next)
         return;
 
-    // Initialize the Lua block parameters with engine values
-    luaBlock.frame = APP->engine->getFrame();
-    luaBlock.samplerate = APP->engine->getSampleRate();
-    luaBlock.sampletime = APP->engine->getSampleTime();
-    luaBlock.channels = NUM_ROWS;
-
-    // Initialize inputs and outputs
-    for (int i = 0; i < NUM_ROWS; i++)
+    // A crossfade still in progress is cut short by the next reload
+    if (crossfade)
     {
-        if (inputs[LUA_INPUTS + i].isConnected())
-            luaBlock.input[i] = inputs[LUA_INPUTS + i].getVoltage();
-        else
-            luaBlock.input[i] = 0.f;
-
-        for (int c = 0; c < 3; c++)
-            luaBlock.light[i][c] = 0.f;
-
-        luaBlock.knob[i] = params[LUA_KNOBS + i].getValue();
-        luaBlock.button[i] = false;
-        luaBlock.output[i] = 0.f;
+        retiredScript.store(fadeScript, std::memory_order_release);
+        fadeScript = script;
+        std::swap(oversamplers, fadeOversamplers);
+        fadePos = 0;
+        fadeLength = std::max(1, (int)(crossfadeTime * APP->engine->getSampleRate()));
     }
-
-    // Retrieve the sandbox environment table and get its index
-    lua_getglobal(L, "_SANDBOX");
-    int sandbox_idx = lua_gettop(L);
-
-    // Create the Lua block object by casting the C struct into Lua cdata
-    lua_getglobal(L, "_castBlock");
-    lua_pushlightuserdata(L, (void *)&luaBlock);
-    if (lua_pcall(L, 1, 1, 0))
+    else
     {
-        setStatus(STATUS_ERROR, std::string("Lua error: Could not cast block:\n") + lua_tostring(L, -1));
-        lua_pop(L, 2); // Pop error and sandbox
-        return;
+        retiredScript.store(script, std::memory_order_release);
     }
-    lua_setfield(L, sandbox_idx, "block"); // sandbox.block = block_cdata
+    script = next;
+
+    // Block size changes and new scripts both start on a fresh block
+    script->block.blocksize = getScriptBlockSize(script->oversample);
+    script->blockIndex = 0;
+    oversamplers.setFactor(script->oversample);
+    blockMode = script->blockMode;
+    profiler.reset();
+    asyncActive = false;
+    scriptLoaded = true;
+    scriptRunning = runOnLoad.exchange(true, std::memory_order_relaxed);
+    postStatus(STATUS_OK, "");
+}
+
+// Destroys retired scripts on a worker thread, since closing a large state can take a while
+void LuaBox::collectScripts()
+{
+    if (LuaScript *retired = retiredScript.exchange(nullptr, std::memory_order_acq_rel))
+        LuaWorker::instance().post(jobs, [=]() { delete retired; });
+}
 
-    // Load script
-    /*
-    if (luaL_loadfile(L, scriptPath.c_str()))
+// UI thread: the samples are decoded on the worker pool, each job holds its script's sample bank
+void LuaBox::loadSamples()
+{
+    LuaSampleRequest request;
+    while (sampleRequests.pop(request))
     {
-        setStatus(STATUS_ERROR, std::string("Lua script error:\n") + lua_tostring(L, -1));
-        lua_pop(L, 2); // Pop error and sandbox
-        return;
+        LuaWorker::instance().post(jobs, [request]() { request.bank->decode(request.slot); });
     }
-    */
+}
 
-    // Load script from string
-    if (luaL_loadstring(L, scriptString.c_str()))
+// UI thread: moves script log lines into Rack's log and the console
+void LuaBox::drainLog()
+{
+    LuaLogMessage message;
+    while (logBuffer.pop(message))
     {
-        setStatus(STATUS_ERROR, std::string("Lua script error:\n") + lua_tostring(L, -1));
-        lua_pop(L, 2);
-        return;
+        if (message.level >= 2)
+            WARN("%s", message.text);
+        else if (message.level == 1)
+            INFO("%s", message.text);
+        else
+            DEBUG("%s", message.text);
+        addConsoleLine(std::string(message.text, message.length));
     }
 
-    // Set the sandbox environment table for the loaded Lua script
-    lua_pushvalue(L, sandbox_idx);
-    if (!lua_setfenv(L, -2))
+    if (uint32_t dropped = logBuffer.takeDropped())
     {
-        setStatus(STATUS_ERROR, "Lua error:\nFailed to set function environment");
-        lua_pop(L, 2); // Pop function and sandbox
-        return;
+        std::string line = string::f("%u log lines dropped, scripts can log up to %d lines per second", dropped, LuaLogBuffer::RATE_LIMIT);
+        WARN("%s", line.c_str());
+        addConsoleLine(line);
     }
+}
+
+void LuaBox::addConsoleLine(std::string line)
+{
+    console.push_back(std::move(line));
+    if (console.size() > CONSOLE_LINES)
+        console.pop_front();
+    consoleVersion++;
+}
 
-    // Execute script
-    if (lua_pcall(L, 0, 0, 0))
+// Called whenever the path or the watch setting changes
+void LuaBox::updateWatch()
+{
+    if (watchFile && !scriptPath.empty())
     {
-        setStatus(STATUS_ERROR, std::string("Lua script error:\n") + lua_tostring(L, -1));
-        lua_pop(L, 2); // Pop error and sandbox
-        return;
+        LuaWatcher::instance().watch(this, scriptPath, [this](std::string source) {
+            std::lock_guard<std::mutex> lock(watchMutex);
+            watchedSource = std::move(source);
+            watchReloadRequested = true;
+        });
+        watching = true;
     }
-
-    // Get and validate process function
-    lua_getfield(L, sandbox_idx, "process");
-    if (!lua_isfunction(L, -1))
+    else if (watching)
     {
-        setStatus(STATUS_ERROR, "Lua script error:\nRequired `process()` function not found");
-        lua_pop(L, 2); // Pop nil and sandbox
-        return;
+        LuaWatcher::instance().unwatch(this);
+        watching = false;
     }
-
-    // Save the process function globally for access later
-    lua_setglobal(L, "_process");
-    lua_pop(L, 1); // Pop sandbox
-
-    scriptLoaded = true;
-    scriptRunning = true;
-    setStatus(STATUS_OK, "");
-
-    INFO("Lua script %s loaded and `process` function set", scriptPath.c_str());
 }
 
-void LuaBox::runScript()
+// Saves that don't change the source, like touching the file, don't restart the script
+void LuaBox::loadWatchedScript()
 {
-    lua_getglobal(L, "_process");
-    if (lua_pcall(L, 0, 0, 0))
+    std::string source;
     {
-        setStatus(STATUS_ERROR, std::string("Lua runtime error in `process()` function:\n") + lua_tostring(L, -1));
-        lua_pop(L, 1); // Pop error
-        unloadScript();
-        return;
+        std::lock_guard<std::mutex> lock(watchMutex);
+        source = std::move(watchedSource);
     }
+    if (source.empty() || source == getScriptText()->source)
+        return;
+    setScriptText(std::move(source));
+    loadScript();
 }
 
 void LuaBox::loadString()
@@ -280,28 +274,40 @@ void LuaBox::loadString()
     std::ifstream file(scriptPath);
     if (!file)
     {
-        setStatus(STATUS_ERROR, "Failed to open script file: " + scriptPath);
-        lua_pop(L, 1); // Pop sandbox
+        postStatus(STATUS_ERROR, "Failed to open script file: " + scriptPath);
         return;
     }
-    scriptString = std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    setScriptText(std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>()));
+}
+
+std::shared_ptr<const ScriptText> LuaBox::getScriptText()
+{
+    return std::atomic_load(&scriptText);
+}
+
+// Publishes a new version of the source and returns its version number
+uint64_t LuaBox::setScriptText(std::string source)
+{
+    std::shared_ptr<ScriptText> text = std::make_shared<ScriptText>();
+    text->source = std::move(source);
+    text->version = ++scriptVersion;
+    uint64_t version = text->version;
+    std::atomic_store(&scriptText, std::shared_ptr<const ScriptText>(std::move(text)));
+    return version;
 }
 
+// Drops the running script and any script still compiling
+// The audio thread drops the pending and the current script in swapScript()
 void LuaBox::unloadScript()
 {
-    scriptLoaded = false;
-    if (L)
-    {
-        lua_close(L);
-        L = nullptr;
-    }
+    ++loadGeneration;
+    unloadRequested = true;
 }
 
 void LuaBox::reloadScript()
 {
     if (!scriptPath.empty())
     {
-        unloadScript();
         loadString();
         loadScript();
     }
@@ -324,6 +330,7 @@ void LuaBox::newScriptDialog()
         if (copyFile(templatePath, newPath))
         {
             scriptPath = newPath;
+            updateWatch();
             loadString();
             loadScript();
         }
@@ -338,6 +345,7 @@ void LuaBox::loadScriptDialog()
     if (!loadPath.empty())
     {
         scriptPath = loadPath;
+        updateWatch();
         loadString();
         loadScript();
     }
@@ -363,12 +371,49 @@ void LuaBox::saveScriptDialog()
         if (copyFile(scriptPath, savePath))
         {
             scriptPath = savePath;
+            updateWatch();
             loadString();
             loadScript();
         }
     }
 }
 
+void LuaBox::exportProfileDialog()
+{
+    std::string defaultFolder = asset::user("");
+    std::string savePath = openFileDialog(OSDIALOG_SAVE, defaultFolder, "luabox-profile.json", nullptr);
+    if (savePath.empty())
+        return;
+
+    if (system::getExtension(savePath).empty())
+        savePath += ".json";
+
+    json_t *rootJ = profileToJson();
+    if (json_dump_file(rootJ, savePath.c_str(), JSON_INDENT(2)))
+        WARN("Could not write profile to %s", savePath.c_str());
+    json_decref(rootJ);
+}
+
+// Copies the message without allocating, a status that doesn't fit in the queue is dropped
+void LuaBox::postStatus(ScriptStatus scriptStatus, const std::string &message)
+{
+    LuaStatusMessage status;
+    status.status = scriptStatus;
+    size_t length = std::min(message.size(), (size_t)LuaStatusMessage::MAX_LENGTH - 1);
+    std::memcpy(status.text, message.data(), length);
+    status.text[length] = '\0';
+    statusMessages.push(status);
+}
+
+// UI thread: applies the statuses in the order they were posted
+void LuaBox::updateStatus()
+{
+    LuaStatusMessage status;
+    while (statusMessages.pop(status))
+        setStatus((ScriptStatus)status.status, status.text);
+}
+
+// UI thread only, the light descriptions and `errorMessage` are read by the widget
 void LuaBox::setStatus(ScriptStatus scriptStatus, const std::string &message)
 {
     errorMessage = message;
@@ -396,19 +441,150 @@ void LuaBox::setStatus(ScriptStatus scriptStatus, const std::string &message)
 void LuaBox::onReset()
 {
     scriptPath = "";
+    setScriptText("");
+    updateWatch();
     unloadScript();
 }
 
+json_t *LuaBox::dataToJson()
+{
+    json_t *rootJ = json_object();
+    json_object_set_new(rootJ, "blockSize", json_integer(blockSize));
+    json_object_set_new(rootJ, "fastCall", json_boolean(fastCall));
+    json_object_set_new(rootJ, "asyncMode", json_boolean(asyncMode));
+    json_object_set_new(rootJ, "oversample", json_integer(oversample));
+    json_object_set_new(rootJ, "controlDivision", json_integer(controlDivision));
+    json_object_set_new(rootJ, "smoothKnobs", json_boolean(smoothKnobs));
+    json_object_set_new(rootJ, "crossfadeTime", json_real(crossfadeTime));
+    json_object_set_new(rootJ, "gcBudget", json_integer(gcBudget));
+    json_object_set_new(rootJ, "memoryLimit", json_integer(memoryLimit));
+    json_object_set_new(rootJ, "deadline", json_integer(deadline));
+
+    // The source is saved with the patch, so it loads without the original file
+    json_object_set_new(rootJ, "path", json_string(scriptPath.c_str()));
+    json_object_set_new(rootJ, "script", json_string(getScriptText()->source.c_str()));
+    json_object_set_new(rootJ, "running", json_boolean(!scriptLoaded || scriptRunning));
+    json_object_set_new(rootJ, "watchFile", json_boolean(watchFile));
+    return rootJ;
+}
+
+void LuaBox::dataFromJson(json_t *rootJ)
+{
+    json_t *blockSizeJ = json_object_get(rootJ, "blockSize");
+    if (blockSizeJ)
+        blockSize = math::clamp((int)json_integer_value(blockSizeJ), 1, MAX_BLOCK_SIZE);
+
+    json_t *fastCallJ = json_object_get(rootJ, "fastCall");
+    if (fastCallJ)
+        fastCall = json_boolean_value(fastCallJ);
+
+    json_t *oversampleJ = json_object_get(rootJ, "oversample");
+    if (oversampleJ)
+    {
+        int factor = (int)json_integer_value(oversampleJ);
+        oversample = (factor == 2 || factor == 4 || factor == 8) ? factor : 1;
+    }
+
+    json_t *controlDivisionJ = json_object_get(rootJ, "controlDivision");
+    if (controlDivisionJ)
+        controlDivision = math::clamp((int)json_integer_value(controlDivisionJ), 1, MAX_BLOCK_SIZE);
+
+    json_t *smoothKnobsJ = json_object_get(rootJ, "smoothKnobs");
+    if (smoothKnobsJ)
+        smoothKnobs = json_boolean_value(smoothKnobsJ);
+
+    json_t *asyncModeJ = json_object_get(rootJ, "asyncMode");
+    if (asyncModeJ)
+        asyncMode = json_boolean_value(asyncModeJ);
+
+    json_t *crossfadeTimeJ = json_object_get(rootJ, "crossfadeTime");
+    if (crossfadeTimeJ)
+        crossfadeTime = math::clamp((float)json_number_value(crossfadeTimeJ), 0.f, 0.05f);
+
+    json_t *gcBudgetJ = json_object_get(rootJ, "gcBudget");
+    if (gcBudgetJ)
+        gcBudget = math::clamp((int)json_integer_value(gcBudgetJ), 1, 1000);
+
+    json_t *memoryLimitJ = json_object_get(rootJ, "memoryLimit");
+    if (memoryLimitJ)
+        memoryLimit = math::clamp((int)json_integer_value(memoryLimitJ), 1, 1024);
+
+    json_t *deadlineJ = json_object_get(rootJ, "deadline");
+    if (deadlineJ)
+        deadline = math::clamp((int)json_integer_value(deadlineJ), 0, 10000);
+
+    json_t *pathJ = json_object_get(rootJ, "path");
+    if (json_is_string(pathJ))
+        scriptPath = json_string_value(pathJ);
+
+    // Compiling happens on the worker pool, so every instance in a patch loads in parallel without blocking the engine
+    json_t *scriptJ = json_object_get(rootJ, "script");
+    if (json_is_string(scriptJ))
+        setScriptText(json_string_value(scriptJ));
+    else if (!scriptPath.empty())
+        loadString();
+
+    json_t *watchFileJ = json_object_get(rootJ, "watchFile");
+    if (watchFileJ)
+        watchFile = json_boolean_value(watchFileJ);
+    updateWatch();
+
+    json_t *runningJ = json_object_get(rootJ, "running");
+    if (runningJ)
+        runOnLoad = json_boolean_value(runningJ);
+
+    if (!getScriptText()->source.empty())
+        loadScript();
+    else
+        unloadScript();
+}
+
+json_t *LuaBox::profileToJson()
+{
+    LuaProfiler::Stats stats = profiler.snapshot();
+    json_t *rootJ = json_object();
+    json_object_set_new(rootJ, "script", json_string(system::getFilename(scriptPath).c_str()));
+    json_object_set_new(rootJ, "mode", json_string(blockMode ? "process_block" : (fastCall ? "fast_call" : "process")));
+    json_object_set_new(rootJ, "blockSize", json_integer(blockSize));
+    json_object_set_new(rootJ, "async", json_boolean(asyncActive));
+    json_object_set_new(rootJ, "oversample", json_integer(oversample));
+    json_object_set_new(rootJ, "latency", json_integer(getLatency()));
+    json_object_set_new(rootJ, "calls", json_integer((json_int_t)stats.calls));
+    json_object_set_new(rootJ, "callsPerSecond", json_real(stats.callsPerSecond));
+    json_object_set_new(rootJ, "minNs", json_real(stats.minNs));
+    json_object_set_new(rootJ, "meanNs", json_real(stats.meanNs));
+    json_object_set_new(rootJ, "p99Ns", json_real(stats.p99Ns));
+    json_object_set_new(rootJ, "maxNs", json_real(stats.maxNs));
+    json_object_set_new(rootJ, "gcUs", json_real(stats.gcTime));
+    json_object_set_new(rootJ, "memoryKB", json_integer(stats.gcMemory));
+    json_object_set_new(rootJ, "memoryPeakKB", json_integer(stats.memoryPeak));
+    json_object_set_new(rootJ, "memoryLimitMB", json_integer(memoryLimit));
+    json_object_set_new(rootJ, "deadlineMs", json_integer(deadline));
+    json_object_set_new(rootJ, "deadlineMisses", json_integer(deadlineMisses));
+
+    json_t *jitJ = json_object();
+    json_object_set_new(jitJ, "enabled", json_boolean(stats.jit.enabled));
+    json_object_set_new(jitJ, "traces", json_integer(stats.jit.traces));
+    json_object_set_new(jitJ, "aborts", json_integer(stats.jit.aborts));
+    json_object_set_new(jitJ, "flushes", json_integer(stats.jit.flushes));
+    json_object_set_new(rootJ, "jit", jitJ);
+    return rootJ;
+}
+
 void LuaBox::process(const ProcessArgs &args)
 {
+    // Reloading reads the file and compiles on other threads, see LuaBoxWidget::step()
     float reloadLight = 0.f;
     if (reloadTrigger.process(params[RELOAD_PARAM].getValue()))
     {
         reloadLight = 1.f;
-        loadScript();
+        reloadRequested = true;
     }
     lights[RELOAD_LIGHT].setBrightnessSmooth(reloadLight, args.sampleTime);
 
+    swapScript();
+    updateBus();
+
     if (runTrigger.process(params[RUN_PARAM].getValue()))
     {
         if (scriptLoaded)
@@ -416,34 +592,481 @@ void LuaBox::process(const ProcessArgs &args)
     }
     lights[RUN_LIGHT].setBrightnessSmooth(scriptRunning, args.sampleTime);
 
-    if (!scriptLoaded || !L || !scriptRunning)
+    // Async mode is switched on a block boundary while no block is in flight
+    bool async = asyncMode && scriptLoaded && !pendingScript.load(std::memory_order_relaxed);
+    if (async != asyncActive && script && script->blockIndex == 0 && !asyncJob.busy.load(std::memory_order_acquire))
+    {
+        asyncActive = async;
+        asyncPending = false;
+        if (async)
+            asyncBlock = script->block;
+    }
+
+    if (!scriptLoaded || !scriptRunning)
         return;
 
+    bool controlFrame = readControls();
+
+    // Run the Lua script's process() or process_block() function
+    if (!processFrame(script, args, outputFrame))
+    {
+        if (script->deadlineMissed)
+            deadlineMisses++;
+        postStatus(STATUS_ERROR, script->errorMessage);
+        scriptLoaded = false;
+        return;
+    }
+
+    // Equal-power crossfade from the previous script, which only runs until the fade is over
+    if (fadeScript && fadePos < fadeLength)
+    {
+        if (processFrame(fadeScript, args, fadeFrame))
+        {
+            float phase = 0.5f * M_PI * fadePos / fadeLength;
+            mixFrames(outputFrame, fadeFrame, std::sin(phase), std::cos(phase));
+            fadePos++;
+        }
+        else
+        {
+            fadePos = fadeLength;
+        }
+    }
+
+    // Set outputs
+    for (int i = 0; i < NUM_ROWS; i++)
+        writeOutput(outputFrame, i);
+
+    if (!controlFrame)
+        return;
+    LuaProcessBlock &block = asyncActive ? asyncBlock : script->block;
+    for (int i = 0; i < NUM_ROWS; i++)
+    {
+        for (int c = 0; c < 3; c++)
+            lights[LUA_LIGHTS + (i * 3) + c].setBrightness(block.light[i][c]);
+    }
+}
+
+// Finds the bus messages of this frame, the right neighbour gets no channels unless the script sends some
+void LuaBox::updateBus()
+{
+    busIn = nullptr;
+    if (leftExpander.module && leftExpander.module->model == modelLuaBox)
+        busIn = static_cast<LuaBusMessage *>(leftExpander.consumerMessage);
+
+    busOut = nullptr;
+    if (rightExpander.module && rightExpander.module->model == modelLuaBox)
+    {
+        busOut = static_cast<LuaBusMessage *>(rightExpander.module->leftExpander.producerMessage);
+        busOut->channels = 0;
+        rightExpander.module->leftExpander.requestMessageFlip();
+    }
+}
+
+// Buffered scripts: copies the bus frame into `factor` frames of the block at `n`, and sends the last output frame
+// The bus is not resampled, oversampled scripts see each frame repeated
+void LuaBox::exchangeBusFrame(LuaProcessBlock &block, int n, int factor, bool send)
+{
+    int channels = busIn ? math::clamp(busIn->channels, 0, NUM_BUS_CHANNELS) : 0;
+    for (int k = 0; k < factor && channels > 0; k++)
+        std::memcpy(block.businputs[n + k], busIn->voltages, channels * sizeof(float));
+    block.businchannels = channels;
+
+    if (send && busOut)
+    {
+        busOut->channels = math::clamp(block.busoutchannels, 0, NUM_BUS_CHANNELS);
+        std::memcpy(busOut->voltages, block.busoutputs[n + factor - 1], busOut->channels * sizeof(float));
+    }
+}
+
+// Reads knobs and buttons every `controlDivision` frames and returns true on those frames
+// Scripts see the held or ramping knob values in between
+bool LuaBox::readControls()
+{
+    if (controlDivider.getDivision() != (uint32_t)controlDivision)
+        controlDivider.setDivision(controlDivision);
+    bool read = !controls.started || controlDivider.process();
+    if (read)
+    {
+        bool ramp = smoothKnobs && controlDivision > 1 && controls.started;
+        for (int i = 0; i < NUM_ROWS; i++)
+        {
+            float knob = params[LUA_KNOBS + i].getValue();
+            controls.knobTarget[i] = knob;
+            controls.knobStep[i] = (knob - controls.knob[i]) / controlDivision;
+            if (!ramp)
+                controls.knob[i] = knob;
+
+            controls.button[i] = params[LUA_BUTTONS + i].getValue() > 0.f;
+            lights[LUA_BUTTONLIGHTS + i].setBrightness(controls.button[i]);
+        }
+        controls.rampFrames = ramp ? controlDivision : 0;
+        controls.started = true;
+    }
+
+    // The last step lands exactly on the target
+    if (controls.rampFrames > 0)
+    {
+        bool last = --controls.rampFrames == 0;
+        for (int i = 0; i < NUM_ROWS; i++)
+            controls.knob[i] = last ? controls.knobTarget[i] : controls.knob[i] + controls.knobStep[i];
+    }
+    return read;
+}
+
+// Feeds one frame to `s` and collects its outputs for this frame, returns false after a runtime error
+bool LuaBox::processFrame(LuaScript *s, const ProcessArgs &args, OutputFrame &frame)
+{
+    if (s->blockMode || fastCall || s->oversample > 1 || (asyncActive && s == script))
+        return processBufferedFrame(s, args, frame);
+
+    LuaProcessBlock &block = s->block;
+    block.samplerate = args.sampleRate;
+    block.sampletime = args.sampleTime;
+
     // Update parameters
-    luaBlock.frame = args.frame;
-    luaBlock.samplerate = args.sampleRate;
-    luaBlock.sampletime = args.sampleTime;
+    block.frame = args.frame;
 
     for (int i = 0; i < NUM_ROWS; i++)
     {
-        luaBlock.knob[i] = params[LUA_KNOBS + i].getValue();
-        luaBlock.input[i] = inputs[LUA_INPUTS + i].getVoltage();
+        block.knob[i] = controls.knob[i];
+        block.input[i] = inputs[LUA_INPUTS + i].getVoltage();
+        block.button[i] = controls.button[i];
+    }
+    readPolyInputs(block, block.polyinput);
+
+    // The script reads and writes the bus messages in place, only the current script sends
+    bool send = busOut && s == script;
+    block.busin = busIn ? busIn->voltages : block.businputs[0];
+    block.busout = send ? busOut->voltages : block.busoutputs[0];
+    block.businchannels = busIn ? math::clamp(busIn->channels, 0, NUM_BUS_CHANNELS) : 0;
 
-        bool press = params[LUA_BUTTONS + i].getValue() > 0.f;
-        luaBlock.button[i] = press;
-        lights[LUA_BUTTONLIGHTS + i].setBrightness(press);
+    uint64_t start = LuaProfiler::getNanoseconds();
+    if (!s->run())
+        return false;
+    if (s == script)
+        profiler.recordCall(LuaProfiler::getNanoseconds() - start);
+    if (send)
+        busOut->channels = math::clamp(block.busoutchannels, 0, NUM_BUS_CHANNELS);
+
+    for (int i = 0; i < NUM_ROWS; i++)
+        readOutput(block, i, block.output[i], block.polyoutput[i], frame);
+
+    if (++s->gcFrames >= blockSize)
+    {
+        s->gcFrames = 0;
+        stepGarbage(s);
     }
+    return true;
+}
 
-    // Run the Lua script's process() function
-    runScript();
+// Buffers one frame of I/O and runs the script once every `blocksize` frames
+// Outputs are read from the previous block, so block mode adds `blocksize` samples of latency
+// Oversampled scripts get `oversample` frames per engine frame, only connected ports go through the filters
+bool LuaBox::processBufferedFrame(LuaScript *s, const ProcessArgs &args, OutputFrame &frame)
+{
+    bool async = asyncActive && s == script;
+    LuaProcessBlock &block = async ? asyncBlock : s->block;
+    Oversamplers &filters = (s == script) ? oversamplers : fadeOversamplers;
+    int factor = s->oversample;
+    block.samplerate = args.sampleRate * factor;
+    block.sampletime = args.sampleTime / factor;
+    int n = s->blockIndex;
+    readPolyInputs(block, block.polyinputs[n]);
+    float resampled[NUM_ROWS][NUM_CHANNELS];
+    const float(*polyoutput)[NUM_CHANNELS] = block.polyoutputs[n];
+    if (factor > 1)
+    {
+        resamplePolyFrame(block, filters, n, factor, resampled);
+        polyoutput = resampled;
+    }
+    for (int i = 0; i < NUM_ROWS; i++)
+    {
+        float voltage = inputs[LUA_INPUTS + i].getVoltage();
+        float knob = controls.knob[i];
+        bool button = controls.button[i];
+        if (factor == 1)
+        {
+            block.inputs[i][n] = voltage;
+            block.knobs[i][n] = knob;
+            block.buttons[i][n] = button;
+            readOutput(block, i, block.outputs[i][n], polyoutput[i], frame);
+            continue;
+        }
 
-    // Set outputs
+        if (inputs[LUA_INPUTS + i].isConnected())
+            filters.inputs[i].upsample(voltage, &block.inputs[i][n]);
+        else
+            std::fill(&block.inputs[i][n], &block.inputs[i][n + factor], voltage);
+        std::fill(&block.knobs[i][n], &block.knobs[i][n + factor], knob);
+        std::fill(&block.buttons[i][n], &block.buttons[i][n + factor], button);
+
+        float output = block.outputs[i][n + factor - 1];
+        if (outputs[LUA_OUTPUTS + i].isConnected())
+            output = filters.outputs[i].downsample(&block.outputs[i][n]);
+        readOutput(block, i, output, polyoutput[i], frame);
+    }
+
+    exchangeBusFrame(block, n, factor, s == script);
+
+    n += factor - 1;
+    s->blockIndex += factor;
+    if (s->blockIndex < block.blocksize)
+        return true;
+
+    // The last frame of the block doubles as the per-block value of the scalar fields
+    int frames = block.blocksize;
+    block.frame = (args.frame + 1) * factor - frames;
     for (int i = 0; i < NUM_ROWS; i++)
     {
-        outputs[LUA_OUTPUTS + i].setVoltage(luaBlock.output[i]);
+        block.input[i] = block.inputs[i][n];
+        block.knob[i] = block.knobs[i][n];
+        block.button[i] = block.buttons[i][n];
+    }
+    std::memcpy(block.polyinput, block.polyinputs[n], sizeof(block.polyinput));
 
-        for (int c = 0; c < 3; c++)
-            lights[LUA_LIGHTS + (i * 3) + c].setBrightness(luaBlock.light[i][c]);
+    s->blockIndex = 0;
+    if (async)
+        return processAsyncBlock(s, frames);
+    return runBufferedBlock(s, frames);
+}
+
+// Runs process_block(), or process() per frame in fast call mode
+bool LuaBox::runBufferedBlock(LuaScript *s, int frames)
+{
+    LuaProcessBlock &block = s->block;
+    uint64_t start = LuaProfiler::getNanoseconds();
+    if (!s->runBlock(frames))
+        return false;
+    if (s == script)
+        profiler.recordCall(LuaProfiler::getNanoseconds() - start);
+
+    // Block size changes take effect on block boundaries
+    block.blocksize = getScriptBlockSize(s->oversample);
+    stepGarbage(s);
+    return true;
+}
+
+// Worker thread: runs one block and its GC step, `busy` is released last since the module may be gone after that
+void LuaBox::AsyncJob::run()
+{
+    uint64_t start = LuaProfiler::getNanoseconds();
+    ok = script->runBlock(frames);
+    time = LuaProfiler::getNanoseconds() - start;
+    gcTime = ok ? 1e6f * (float)script->collectGarbage(gcBudget * 1e-6) : 0.f;
+    busy.store(false, std::memory_order_release);
+}
+
+// Collects the block the pool finished and posts the one just filled, outputs are one more block behind
+// The audio thread never waits: a block still running at this point is an overrun, the block just filled
+// is dropped and `asyncBlock` sends the outputs of the last finished block again
+bool LuaBox::processAsyncBlock(LuaScript *s, int frames)
+{
+    if (asyncJob.busy.load(std::memory_order_acquire))
+    {
+        asyncOverruns++;
+        return true;
+    }
+
+    if (asyncPending)
+    {
+        asyncPending = false;
+        if (!asyncJob.ok)
+            return false;
+        profiler.recordCall(asyncJob.time);
+        recordGarbage(s, asyncJob.gcTime);
+    }
+
+    exchangeAsyncBlock(s, frames);
+    asyncBlock.blocksize = getScriptBlockSize(s->oversample);
+
+    // Async mode is left here, where no block is in flight, for a new script or when switched off
+    // Going back to the script's own block drops one block of output and of latency
+    if (!asyncMode || pendingScript.load(std::memory_order_relaxed))
+    {
+        asyncActive = false;
+        return runBufferedBlock(s, frames);
+    }
+
+    asyncJob.script = s;
+    asyncJob.frames = frames;
+    asyncJob.gcBudget = gcBudget;
+    asyncJob.busy.store(true, std::memory_order_relaxed);
+    asyncPending = true;
+    if (!LuaAsyncPool::instance().post(&asyncJob))
+        asyncJob.run();
+    return true;
+}
+
+// Moves the outputs of the finished block out of the script's block and the new inputs in, only while no job runs
+void LuaBox::exchangeAsyncBlock(LuaScript *s, int frames)
+{
+    LuaProcessBlock &block = s->block;
+    for (int i = 0; i < NUM_ROWS; i++)
+    {
+        std::memcpy(asyncBlock.outputs[i], block.outputs[i], frames * sizeof(float));
+        std::memcpy(asyncBlock.polyoutput[i], block.polyoutput[i], sizeof(block.polyoutput[i]));
+        std::memcpy(asyncBlock.light[i], block.light[i], sizeof(block.light[i]));
+        asyncBlock.outchannels[i] = block.outchannels[i];
+        asyncBlock.output[i] = block.output[i];
+
+        std::memcpy(block.inputs[i], asyncBlock.inputs[i], frames * sizeof(float));
+        std::memcpy(block.knobs[i], asyncBlock.knobs[i], frames * sizeof(float));
+        std::memcpy(block.buttons[i], asyncBlock.buttons[i], frames * sizeof(bool));
+        std::memcpy(block.polyinput[i], asyncBlock.polyinput[i], sizeof(block.polyinput[i]));
+        block.inchannels[i] = asyncBlock.inchannels[i];
+        block.input[i] = asyncBlock.input[i];
+        block.knob[i] = asyncBlock.knob[i];
+        block.button[i] = asyncBlock.button[i];
+    }
+    std::memcpy(asyncBlock.busoutputs, block.busoutputs, frames * sizeof(block.busoutputs[0]));
+    std::memcpy(block.businputs, asyncBlock.businputs, frames * sizeof(block.businputs[0]));
+    std::memcpy(asyncBlock.polyoutputs, block.polyoutputs, frames * sizeof(block.polyoutputs[0]));
+    std::memcpy(block.polyinputs, asyncBlock.polyinputs, frames * sizeof(block.polyinputs[0]));
+    asyncBlock.busoutchannels = block.busoutchannels;
+    block.businchannels = asyncBlock.businchannels;
+
+    block.frame = asyncBlock.frame;
+    block.samplerate = asyncBlock.samplerate;
+    block.sampletime = asyncBlock.sampletime;
+    block.blocksize = frames;
+}
+
+// Runs the script's collector within the per-block budget
+void LuaBox::stepGarbage(LuaScript *s)
+{
+    float time = 1e6f * (float)s->collectGarbage(gcBudget * 1e-6);
+    recordGarbage(s, time);
+}
+
+// Only the current script reports its stats
+void LuaBox::recordGarbage(LuaScript *s, float time)
+{
+    if (s != script)
+        return;
+
+    int peak = s->arena ? (int)(s->arena->getPeak() >> 10) : 0;
+    profiler.recordGarbage(time, s->memoryUsage(), peak);
+    profiler.recordJit(s->jitStats);
+}
+
+// Samples between an input and the output it produces, buffering adds one block and async mode another
+// Oversampling adds the delay of its filters
+int LuaBox::getLatency()
+{
+    if (!scriptLoaded)
+        return 0;
+    int hostBlockSize = getScriptBlockSize(oversample) / oversample;
+    int latency = (blockMode || fastCall || asyncActive || oversample > 1) ? hostBlockSize : 0;
+    if (asyncActive)
+        latency += hostBlockSize;
+    return latency + LuaOversampler::getLatency(oversample);
+}
+
+// Oversampled scripts run `factor` frames per engine frame, blocks are shortened to fit MAX_BLOCK_SIZE
+int LuaBox::getScriptBlockSize(int factor)
+{
+    return std::min(blockSize * factor, MAX_BLOCK_SIZE);
+}
+
+void LuaBox::Oversamplers::setFactor(int factor)
+{
+    for (int i = 0; i < NUM_ROWS; i++)
+    {
+        inputs[i].setFactor(factor);
+        outputs[i].setFactor(factor);
+        for (int c = 0; c < NUM_CHANNELS; c++)
+        {
+            polyInputs[i][c].setFactor(factor);
+            polyOutputs[i][c].setFactor(factor);
+        }
+    }
+}
+
+// Oversampled scripts: spreads the channels read into frame `n` over `factor` frames and downsamples the script's
+// channels from them into `poly`, only the channels in use on connected ports go through the filters
+void LuaBox::resamplePolyFrame(LuaProcessBlock &block, Oversamplers &filters, int n, int factor, float poly[NUM_ROWS][NUM_CHANNELS])
+{
+    float buffer[LuaOversampler::MAX_FACTOR];
+    for (int i = 0; i < NUM_ROWS; i++)
+    {
+        int channels = math::clamp(block.inchannels[i], 0, NUM_CHANNELS);
+        for (int c = 0; c < channels; c++)
+        {
+            filters.polyInputs[i][c].upsample(block.polyinputs[n][i][c], buffer);
+            for (int k = 0; k < factor; k++)
+                block.polyinputs[n + k][i][c] = buffer[k];
+        }
+
+        channels = math::clamp(block.outchannels[i], 0, NUM_CHANNELS);
+        bool connected = outputs[LUA_OUTPUTS + i].isConnected();
+        for (int c = 0; c < channels; c++)
+        {
+            for (int k = 0; k < factor; k++)
+                buffer[k] = block.polyoutputs[n + k][i][c];
+            poly[i][c] = connected ? filters.polyOutputs[i][c].downsample(buffer) : buffer[factor - 1];
+        }
+    }
+}
+
+// Copies all channels of every input into one frame of polyphonic channels
+void LuaBox::readPolyInputs(LuaProcessBlock &block, float poly[NUM_ROWS][NUM_CHANNELS])
+{
+    for (int i = 0; i < NUM_ROWS; i++)
+    {
+        block.inchannels[i] = inputs[LUA_INPUTS + i].getChannels();
+        inputs[LUA_INPUTS + i].readVoltages(poly[i]);
+    }
+}
+
+// Rows are polyphonic once the script sets `block.outchannels[i]` and send the frame's channels in `poly`
+// Otherwise `voltage` is sent as mono
+void LuaBox::readOutput(LuaProcessBlock &block, int row, float voltage, const float *poly, OutputFrame &frame)
+{
+    int channels = math::clamp(block.outchannels[row], 0, NUM_CHANNELS);
+    frame.channels[row] = channels;
+    if (channels > 0)
+    {
+        for (int c = 0; c < channels; c++)
+            frame.voltages[row][c] = poly[c];
+    }
+    else
+    {
+        frame.voltages[row][0] = voltage;
+    }
+}
+
+void LuaBox::writeOutput(OutputFrame &frame, int row)
+{
+    Output &output = outputs[LUA_OUTPUTS + row];
+    int channels = frame.channels[row];
+    if (channels > 0)
+    {
+        output.setChannels(channels);
+        output.writeVoltages(frame.voltages[row]);
+    }
+    else
+    {
+        output.setChannels(1);
+        output.setVoltage(frame.voltages[row][0]);
+    }
+}
+
+// Mixes `other` into `frame`, missing channels count as silence
+void LuaBox::mixFrames(OutputFrame &frame, const OutputFrame &other, float gain, float otherGain)
+{
+    for (int i = 0; i < NUM_ROWS; i++)
+    {
+        int channels = std::max(frame.channels[i], 1);
+        int otherChannels = std::max(other.channels[i], 1);
+        int mixChannels = std::max(channels, otherChannels);
+        for (int c = 0; c < mixChannels; c++)
+        {
+            float a = (c < channels) ? frame.voltages[i][c] : 0.f;
+            float b = (c < otherChannels) ? other.voltages[i][c] : 0.f;
+            frame.voltages[i][c] = a * gain + b * otherGain;
+        }
+        if (mixChannels > 1)
+            frame.channels[i] = mixChannels;
     }
 }
 
@@ -470,6 +1093,25 @@ struct LuaBoxWidget : ModuleWidget
         }
     };
 
+    // Reload requests from the audio thread and retired scripts are handled here, off the audio thread
+    void step() override
+    {
+        LuaBox *luaBox = dynamic_cast<LuaBox *>(module);
+        if (luaBox)
+        {
+            if (luaBox->reloadRequested.exchange(false))
+                luaBox->loadScript();
+            if (luaBox->watchReloadRequested.exchange(false))
+                luaBox->loadWatchedScript();
+            luaBox->updateStatus();
+            luaBox->collectScripts();
+            luaBox->drainLog();
+            luaBox->loadSamples();
+            luaBox->profiler.updateRate(system::getTime());
+        }
+        ModuleWidget::step();
+    }
+
     LuaBoxWidget(LuaBox *module)
     {
         setModule(module);
@@ -556,6 +1198,142 @@ struct LuaBoxWidget : ModuleWidget
         };
         addMenuItem<ReloadScriptItem>(menu, "Reload script", luaBox);
 
+        menu->addChild(createBoolMenuItem(
+            "Reload on save", "", [=]() { return luaBox->watchFile; },
+            [=](bool watch) {
+                luaBox->watchFile = watch;
+                luaBox->updateWatch();
+            }));
+
+        // Block size used by scripts that define `process_block()` and by fast call mode
+        menu->addChild(new MenuSeparator);
+        menu->addChild(createSubmenuItem("Block size", string::f("%d", luaBox->blockSize), [=](Menu *menu) {
+            static constexpr std::array<int, 5> blockSizes = {16, 32, 64, 128, 256};
+            for (int size : blockSizes)
+            {
+                menu->addChild(createCheckMenuItem(
+                    string::f("%d", size), "", [=]() { return luaBox->blockSize == size; },
+                    [=]() { luaBox->blockSize = size; }));
+            }
+        }));
+        menu->addChild(createBoolPtrMenuItem("Fast call (one protected call per block)", "", &luaBox->fastCall));
+
+        // The script's `control()` interval is set when it loads, so a new rate reloads the script
+        std::string controlRate = luaBox->controlDivision > 1 ? string::f("Every %d samples", luaBox->controlDivision) : "Every sample";
+        menu->addChild(createSubmenuItem("Control rate", controlRate, [=](Menu *menu) {
+            static constexpr std::array<int, 6> divisions = {1, 16, 32, 64, 128, 256};
+            for (int division : divisions)
+            {
+                menu->addChild(createCheckMenuItem(
+                    division > 1 ? string::f("Every %d samples", division) : "Every sample", "",
+                    [=]() { return luaBox->controlDivision == division; },
+                    [=]() {
+                        luaBox->controlDivision = division;
+                        luaBox->loadScript();
+                    }));
+            }
+        }));
+        menu->addChild(createBoolPtrMenuItem("Smooth knobs", "", &luaBox->smoothKnobs));
+
+        // Scripts get their sample rate when they load, so a new factor reloads the script
+        menu->addChild(createSubmenuItem("Oversampling", luaBox->oversample > 1 ? string::f("%dx", luaBox->oversample) : "Off", [=](Menu *menu) {
+            static constexpr std::array<int, 4> factors = {1, 2, 4, 8};
+            for (int factor : factors)
+            {
+                menu->addChild(createCheckMenuItem(
+                    factor > 1 ? string::f("%dx", factor) : "Off", "", [=]() { return luaBox->oversample == factor; },
+                    [=]() {
+                        luaBox->oversample = factor;
+                        luaBox->loadScript();
+                    }));
+            }
+        }));
+
+        // Crossfade between the old and new script on reload
+        menu->addChild(createSubmenuItem("Reload crossfade", luaBox->crossfadeTime > 0.f ? string::f("%g ms", luaBox->crossfadeTime * 1000.f) : "Off", [=](Menu *menu) {
+            static constexpr std::array<float, 5> crossfadeTimes = {0.f, 0.005f, 0.01f, 0.02f, 0.05f};
+            for (float time : crossfadeTimes)
+            {
+                menu->addChild(createCheckMenuItem(
+                    time > 0.f ? string::f("%g ms", time * 1000.f) : "Off", "", [=]() { return luaBox->crossfadeTime == time; },
+                    [=]() { luaBox->crossfadeTime = time; }));
+            }
+        }));
+
+        // Async mode trades a block of latency for running on another core
+        menu->addChild(createBoolMenuItem(
+            "Async (runs on a worker thread)", "", [=]() { return luaBox->asyncMode; },
+            [=](bool async) {
+                luaBox->asyncMode = async;
+                luaBox->asyncOverruns = 0;
+            }));
+        if (luaBox->asyncMode && luaBox->asyncOverruns > 0)
+            menu->addChild(createMenuLabel(string::f("Async overruns: %d blocks repeated", luaBox->asyncOverruns)));
+        int latency = luaBox->getLatency();
+        if (latency > 0)
+        {
+            float latencyMs = 1000.f * latency / APP->engine->getSampleRate();
+            menu->addChild(createMenuLabel(string::f("Latency: %d samples (%.2f ms)", latency, latencyMs)));
+        }
+
+        // Garbage collection runs once per block instead of whenever the script allocates
+        menu->addChild(createSubmenuItem("GC budget per block", string::f("%d µs", luaBox->gcBudget), [=](Menu *menu) {
+            static constexpr std::array<int, 5> gcBudgets = {20, 50, 100, 200, 500};
+            for (int budget : gcBudgets)
+            {
+                menu->addChild(createCheckMenuItem(
+                    string::f("%d µs", budget), "", [=]() { return luaBox->gcBudget == budget; },
+                    [=]() { luaBox->gcBudget = budget; }));
+            }
+        }));
+        // The arena is reserved when the script loads, so a new limit applies from the next reload
+        menu->addChild(createSubmenuItem("Memory limit", string::f("%d MB", luaBox->memoryLimit), [=](Menu *menu) {
+            static constexpr std::array<int, 5> memoryLimits = {8, 16, 32, 64, 128};
+            for (int limit : memoryLimits)
+            {
+                menu->addChild(createCheckMenuItem(
+                    string::f("%d MB", limit), "", [=]() { return luaBox->memoryLimit == limit; },
+                    [=]() { luaBox->memoryLimit = limit; }));
+            }
+        }));
+
+        // Like the memory limit, the deadline is handed to the script when it loads
+        menu->addChild(createSubmenuItem("CPU deadline", luaBox->deadline > 0 ? string::f("%d ms", luaBox->deadline) : "Off", [=](Menu *menu) {
+            static constexpr std::array<int, 5> deadlines = {0, 10, 50, 100, 500};
+            for (int time : deadlines)
+            {
+                menu->addChild(createCheckMenuItem(
+                    time > 0 ? string::f("%d ms", time) : "Off", "", [=]() { return luaBox->deadline == time; },
+                    [=]() { luaBox->deadline = time; }));
+            }
+        }));
+        if (luaBox->deadlineMisses > 0)
+            menu->addChild(createMenuLabel(string::f("Deadline misses: %d", luaBox->deadlineMisses)));
+
+        // Profile of the current script, calls are `process()` frames or whole blocks
+        if (luaBox->scriptLoaded)
+        {
+            LuaProfiler::Stats stats = luaBox->profiler.snapshot();
+            menu->addChild(new MenuSeparator);
+            menu->addChild(createMenuLabel(string::f("Calls: %.0f/s, %.0f/%.0f/%.0f/%.0f ns min/mean/p99/max", stats.callsPerSecond,
+                                                     stats.minNs, stats.meanNs, stats.p99Ns, stats.maxNs)));
+            menu->addChild(createMenuLabel(string::f("GC: %.1f µs per block, %d KB heap", stats.gcTime, stats.gcMemory)));
+            menu->addChild(createMenuLabel(string::f("Memory peak: %d KB of %d MB", stats.memoryPeak, luaBox->memoryLimit)));
+
+            // Aborts without any compiled trace mean the hot loop stays in the interpreter
+            std::string jitStatus = !stats.jit.enabled ? "off"
+                                    : stats.jit.traces > 0 ? "compiled"
+                                    : stats.jit.aborts > 0 ? "interpreted, traces abort"
+                                                           : "interpreted";
+            menu->addChild(createMenuLabel(string::f("JIT: %s (%d traces, %d aborts)", jitStatus.c_str(), stats.jit.traces, stats.jit.aborts)));
+
+            struct ExportProfileItem : MenuItem_Script
+            {
+                void onAction(const event::Action &e) override { module->exportProfileDialog(); }
+            };
+            addMenuItem<ExportProfileItem>(menu, "Export profile as JSON", luaBox);
+        }
+
         // Show error details if an error message exists
         if (!luaBox->errorMessage.empty())
         {
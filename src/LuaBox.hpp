@@ -3,19 +3,48 @@
 #pragma once
 
 #include "plugin.hpp"
-#include "lua.hpp"
+#include "LuaScript.hpp"
+#include "LuaWorker.hpp"
+#include "LuaWatcher.hpp"
+#include "LuaAsync.hpp"
+#include "LuaOversampler.hpp"
 #include <array>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <fstream>  // For std::ifstream
 #include <iterator> // For std::istreambuf_iterator
 
 using namespace rack;
 
-#define NUM_ROWS 8
-#define NUM_COLOR 3
-
 extern Model *modelLuaBox;
 
+// Immutable script source, edits publish a new one so other threads never see a partial string
+struct ScriptText
+{
+    std::string source;
+    uint64_t version = 0;
+};
+
+// Expander message from a LuaBox to the LuaBox on its right, one frame of bus channels
+// Other modules can join the bus by writing and reading this message from either side
+struct LuaBusMessage
+{
+    int channels = 0;
+    float voltages[NUM_BUS_CHANNELS] = {};
+};
+
+// Script status on its way from a worker or the audio thread to the UI thread
+// Only the UI thread writes `errorMessage` and the lights' descriptions, longer messages are cut off
+struct LuaStatusMessage
+{
+    static constexpr int MAX_LENGTH = 1024;
+    int status;
+    char text[MAX_LENGTH];
+};
+
 struct LuaBox : Module
 {
     enum ParamIds
@@ -50,17 +79,11 @@ struct LuaBox : Module
         NUM_LIGHTS
     };
 
-    struct LuaProcessBlock
+    // Output voltages of one frame, `channels` is 0 for rows sent as mono
+    struct OutputFrame
     {
-        int64_t frame;
-        float samplerate;
-        float sampletime;
-        int channels;
-        float input[NUM_ROWS];
-        float knob[NUM_ROWS];
-        float light[NUM_ROWS][NUM_COLOR];
-        bool button[NUM_ROWS];
-        float output[NUM_ROWS];
+        float voltages[NUM_ROWS][NUM_CHANNELS];
+        int channels[NUM_ROWS];
     };
 
     enum ScriptStatus
@@ -70,15 +93,126 @@ struct LuaBox : Module
         STATUS_ERROR
     };
 
-    lua_State *L = nullptr;
-    LuaProcessBlock luaBlock;
+    // Owned by the audio thread, scripts are compiled by LuaWorker and swapped in on a block boundary
+    LuaScript *script = nullptr;
+    std::atomic<LuaScript *> pendingScript{nullptr};
+    std::atomic<LuaScript *> retiredScript{nullptr};
+    std::atomic<bool> unloadRequested{false};
+    std::atomic<bool> reloadRequested{false};
+    std::atomic<uint64_t> loadGeneration{0};
+    std::atomic<bool> runOnLoad{true};
+    LuaJobGroup jobs;
 
     bool scriptLoaded = false;
     bool scriptRunning = false;
 
+    // Block mode is used when the script defines `process_block(n)`
+    // Fast call mode buffers `process()` the same way with one protected call per block
+    bool blockMode = false;
+    bool fastCall = false;
+    int blockSize = 64;
+
+    // The previous script keeps running during an equal-power crossfade after a reload
+    LuaScript *fadeScript = nullptr;
+    float crossfadeTime = 0.f;
+    int fadePos = 0;
+    int fadeLength = 0;
+    OutputFrame outputFrame;
+    OutputFrame fadeFrame;
+
+    // Oversampling factor for new scripts, each script keeps the factor it was loaded with
+    // Up- and downsamplers of the current and the fading script, swapped along with the scripts
+    struct Oversamplers
+    {
+        LuaOversampler inputs[NUM_ROWS];
+        LuaOversampler outputs[NUM_ROWS];
+        LuaOversampler polyInputs[NUM_ROWS][NUM_CHANNELS];
+        LuaOversampler polyOutputs[NUM_ROWS][NUM_CHANNELS];
+        void setFactor(int factor);
+    };
+    int oversample = 1;
+    Oversamplers oversamplers;
+    Oversamplers fadeOversamplers;
+
+    // Knobs, buttons and lights are handled every `controlDivision` frames, the script's `control()` runs at the same rate
+    // With smoothing, knobs ramp linearly to the new value until the next read
+    struct Controls
+    {
+        float knob[NUM_ROWS] = {};
+        float knobStep[NUM_ROWS] = {};
+        float knobTarget[NUM_ROWS] = {};
+        bool button[NUM_ROWS] = {};
+        int rampFrames = 0;
+        bool started = false;
+    };
+    int controlDivision = 1;
+    bool smoothKnobs = true;
+    dsp::ClockDivider controlDivider;
+    Controls controls;
+
+    // Async mode runs the current script's blocks on LuaAsyncPool, one block behind the audio thread
+    // While a worker runs a block in the script's own block, the audio thread fills `asyncBlock`
+    struct AsyncJob : LuaAsyncJob
+    {
+        LuaScript *script = nullptr;
+        int frames = 0;
+        int gcBudget = 0;
+        bool ok = true;
+        uint64_t time = 0;
+        float gcTime = 0.f;
+        std::atomic<bool> busy{false};
+        void run() override;
+    };
+    bool asyncMode = false;
+    bool asyncActive = false;
+    bool asyncPending = false;
+    // Blocks dropped because the previous one was still running, their outputs repeat the last block
+    int asyncOverruns = 0;
+    AsyncJob asyncJob;
+    LuaProcessBlock asyncBlock;
+
+    // Scripts run with the collector stopped, LuaBox steps it once per block within this budget in µs
+    int gcBudget = 50;
+
+    // Size of each script's memory arena in MB
+    int memoryLimit = 32;
+
+    // A call or block running longer than this many ms is stopped and the script disabled, 0 disables the watchdog
+    int deadline = 100;
+    int deadlineMisses = 0;
+
+    // Double-buffered messages from the LuaBox on the left, and the messages of the current frame
+    // Rack flips them after every frame, so a hop takes one sample like a cable
+    LuaBusMessage busMessages[2];
+    LuaBusMessage *busIn = nullptr;
+    LuaBusMessage *busOut = nullptr;
+
+    // Call timing, GC and JIT stats of the current script for the context menu
+    LuaProfiler profiler;
+
+    // Opt-in reload on save, the shared watcher reads the file and the widget step loads it
+    bool watchFile = false;
+    bool watching = false;
+    std::mutex watchMutex;
+    std::string watchedSource;
+    std::atomic<bool> watchReloadRequested{false};
+
+    // Script `print()` and `log.*()` lines, drained by the widget step into Rack's log and the console
+    static constexpr size_t CONSOLE_LINES = 200;
+    LuaLogBuffer logBuffer;
+
+    // `sample.load()` requests from scripts, decoded on LuaWorker by the widget step
+    LuaSampleQueue sampleRequests;
+    std::deque<std::string> console;
+    uint64_t consoleVersion = 0;
+
+    // Swapped with std::atomic_load/atomic_store, `scriptVersion` lets the editor skip unchanged text
+    std::shared_ptr<const ScriptText> scriptText = std::make_shared<const ScriptText>();
+    std::atomic<uint64_t> scriptVersion{0};
+
     std::string scriptPath = "";
-    std::string scriptString = "";
     std::string errorMessage = "";
+    LuaQueue<LuaStatusMessage, 16> statusMessages;
 
     dsp::BooleanTrigger reloadTrigger;
     dsp::BooleanTrigger runTrigger;
@@ -92,19 +226,48 @@ struct LuaBox : Module
     void unloadScript();
     void reloadScript();
     void loadString();
-    void runScript();
-    bool createLuaState();
-    static int lua_sandboxPrint(lua_State *L);
+    std::shared_ptr<const ScriptText> getScriptText();
+    uint64_t setScriptText(std::string source);
+    void swapScript();
+    void collectScripts();
+    void updateWatch();
+    void loadWatchedScript();
+    void drainLog();
+    void loadSamples();
+    void addConsoleLine(std::string line);
 
     // File dialog methods
     void newScriptDialog();
     void loadScriptDialog();
     void saveScriptDialog();
+    void exportProfileDialog();
 
-    // Status management
+    // Status management, postStatus() is safe on any thread and updateStatus() applies it on the UI thread
     void setStatus(ScriptStatus scriptStatus, const std::string &message);
+    void postStatus(ScriptStatus scriptStatus, const std::string &message);
+    void updateStatus();
 
     // Module methods
     void onReset() override;
+    json_t *dataToJson() override;
+    void dataFromJson(json_t *rootJ) override;
+    json_t *profileToJson();
     void process(const ProcessArgs &args) override;
+    void updateBus();
+    void exchangeBusFrame(LuaProcessBlock &block, int n, int factor, bool send);
+    bool readControls();
+    bool processFrame(LuaScript *s, const ProcessArgs &args, OutputFrame &frame);
+    bool processBufferedFrame(LuaScript *s, const ProcessArgs &args, OutputFrame &frame);
+    bool runBufferedBlock(LuaScript *s, int frames);
+    bool processAsyncBlock(LuaScript *s, int frames);
+    void exchangeAsyncBlock(LuaScript *s, int frames);
+    void stepGarbage(LuaScript *s);
+    void recordGarbage(LuaScript *s, float time);
+    int getLatency();
+    int getScriptBlockSize(int factor);
+    void readPolyInputs(LuaProcessBlock &block, float poly[NUM_ROWS][NUM_CHANNELS]);
+    void resamplePolyFrame(LuaProcessBlock &block, Oversamplers &filters, int n, int factor, float poly[NUM_ROWS][NUM_CHANNELS]);
+    void readOutput(LuaProcessBlock &block, int row, float voltage, const float *poly, OutputFrame &frame);
+    void writeOutput(OutputFrame &frame, int row);
+    static void mixFrames(OutputFrame &frame, const OutputFrame &other, float gain, float otherGain);
 }; // LuaBox
\ No newline at end of file
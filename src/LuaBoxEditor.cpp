@@ -41,11 +41,26 @@ struct LuaBoxEditor : Module
     }
 }; // LuaBoxEditor
 
+// Script editor layout, in px
+static const float EDITOR_FONT_SIZE = 13.f;
+static const float EDITOR_LINE_HEIGHT = 16.f;
+static const float EDITOR_PADDING = 5.f;
+static const float CONSOLE_HEIGHT = 75.f;
+
 struct LuaBoxEditorWidget : ModuleWidget
 {
     struct ScriptEditor : ui::TextField
     {
         LuaBoxEditor *module;
+        // Version of the LuaBox script text shown in the editor
+        uint64_t textVersion = 0;
+
+        // Line index and widths of `text`, edits only measure the lines they touched
+        std::string layoutText;
+        std::vector<int> lineStarts = {0};
+        std::vector<float> lineWidths = {0.f};
+        float maxWidth = 0.f;
+        bool layoutDirty = true;
 
         ScriptEditor()
         {
@@ -53,53 +68,105 @@ struct LuaBoxEditorWidget : ModuleWidget
             multiline = true;
         }
 
+        void setFont(NVGcontext *vg)
+        {
+            nvgFontSize(vg, EDITOR_FONT_SIZE);
+            nvgFontFaceId(vg, APP->window->uiFont->handle);
+        }
+
+        int getLineCount() { return (int)lineStarts.size(); }
+
+        // Index of the line containing `pos`
+        int getLine(int pos) { return (int)(std::upper_bound(lineStarts.begin(), lineStarts.end(), pos) - lineStarts.begin()) - 1; }
+
+        // End of a line, not counting its newline
+        int getLineEnd(int line) { return line + 1 < getLineCount() ? lineStarts[line + 1] - 1 : (int)text.size(); }
+
+        float measure(NVGcontext *vg, int begin, int end)
+        {
+            if (begin >= end)
+                return 0.f;
+            return nvgTextBounds(vg, 0.f, 0.f, text.c_str() + begin, text.c_str() + end, NULL);
+        }
+
+        // Replaces the old lines around the changed range with the new ones, the lines after it are only shifted
+        void updateLayout(NVGcontext *vg)
+        {
+            int oldSize = (int)layoutText.size();
+            int newSize = (int)text.size();
+            int limit = std::min(oldSize, newSize);
+            int prefix = 0;
+            while (prefix < limit && layoutText[prefix] == text[prefix])
+                prefix++;
+            int suffix = 0;
+            while (suffix < limit - prefix && layoutText[oldSize - 1 - suffix] == text[newSize - 1 - suffix])
+                suffix++;
+            if (prefix == oldSize && prefix == newSize)
+                return;
+
+            int first = getLine(prefix);
+            int last = getLine(oldSize - suffix);
+            int changeEnd = newSize - suffix;
+
+            std::vector<int> starts;
+            std::vector<float> widths;
+            int start = lineStarts[first];
+            while (true)
+            {
+                size_t newline = text.find('\n', start);
+                int end = newline == std::string::npos ? newSize : (int)newline;
+                starts.push_back(start);
+                widths.push_back(measure(vg, start, end));
+                if (newline == std::string::npos || end >= changeEnd)
+                    break;
+                start = end + 1;
+            }
+
+            int shift = newSize - oldSize;
+            for (size_t i = last + 1; i < lineStarts.size(); i++)
+                lineStarts[i] += shift;
+            lineStarts.erase(lineStarts.begin() + first, lineStarts.begin() + last + 1);
+            lineStarts.insert(lineStarts.begin() + first, starts.begin(), starts.end());
+            lineWidths.erase(lineWidths.begin() + first, lineWidths.begin() + last + 1);
+            lineWidths.insert(lineWidths.begin() + first, widths.begin(), widths.end());
+            maxWidth = *std::max_element(lineWidths.begin(), lineWidths.end());
+            layoutText = text;
+        }
+
         void step() override
         {
-            // Update text from the connected LuaBox module
-            if (module && module->luabox && !module->luabox->scriptPath.empty())
-                text = module->luabox->scriptString;
+            // Update text from the connected LuaBox module, only when it has published a new version
+            if (module && module->luabox && module->luabox->scriptVersion != textVersion)
+            {
+                std::shared_ptr<const ScriptText> script = module->luabox->getScriptText();
+                text = script->source;
+                textVersion = script->version;
+                cursor = std::min(cursor, (int)text.size());
+                selection = std::min(selection, (int)text.size());
+                layoutDirty = true;
+            }
 
             NVGcontext *vg = APP->window->vg;
-
-            if (vg)
+            if (vg && layoutDirty)
             {
-                auto font = APP->window->uiFont;
-                auto fontSize = 13.0f;
-
-                nvgFontSize(vg, fontSize);
-                nvgFontFaceId(vg, font->handle);
-
-                // Calculate height based on line count
-                int numLines = std::count(text.begin(), text.end(), '\n') + 1;
-                float lineHeight = fontSize * 1.f;
-                float height = lineHeight * numLines;
-
-                // Calculate maximum line width
-                float maxWidth = 0.f;
-                std::istringstream stream(text);
-                std::string line;
-                while (std::getline(stream, line))
-                {
-                    float bounds[4];
-                    nvgTextBounds(vg, 0.f, 0.f, line.c_str(), NULL, bounds);
-                    float lineWidth = bounds[2] - bounds[0];
-                    if (lineWidth > maxWidth)
-                        maxWidth = lineWidth;
-                }
+                setFont(vg);
+                updateLayout(vg);
+                layoutDirty = false;
 
                 float padding = 25.f;
                 float minWidth = 370.f;
-                float minHeight = 335.f;
+                float minHeight = 335.f - CONSOLE_HEIGHT;
 
                 // Set box size with minimum dimensions
                 float newWidth = std::max(maxWidth + padding, minWidth);
-                float newHeight = std::max(height + padding, minHeight);
+                float newHeight = std::max(getLineCount() * EDITOR_LINE_HEIGHT + padding, minHeight);
                 box.size = Vec(newWidth, newHeight);
             }
 
             ui::TextField::step();
         }
 
+        // Draws only the lines inside the clip box, which the scroll container limits to its viewport
         void draw(const DrawArgs &args) override
         {
             nvgScissor(args.vg, RECT_ARGS(args.clipBox));
@@ -112,23 +179,91 @@ struct LuaBoxEditorWidget : ModuleWidget
             else
                 state = BND_DEFAULT;
 
+            // Draw the text field without text
+            bndTextField(args.vg, 0.0, 0.0, box.size.x, box.size.y, BND_CORNER_ALL, state, -1, "", -1, -1);
+            if (layoutDirty)
+            {
+                nvgResetScissor(args.vg);
+                return;
+            }
+
+            const BNDtheme *theme = bndGetTheme();
+            NVGcolor textColor = state == BND_ACTIVE ? theme->textFieldTheme.textSelectedColor : theme->textFieldTheme.textColor;
+            NVGcolor caretColor = nvgRGBA(0x56, 0x80, 0xc2, 0xff);
             int begin = std::min(cursor, selection);
             int end = std::max(cursor, selection);
 
-            std::string drawText;
-            drawText = text;
+            setFont(args.vg);
+            nvgTextAlign(args.vg, NVG_ALIGN_LEFT | NVG_ALIGN_TOP);
+            int firstLine = math::clamp((int)((args.clipBox.getTop() - EDITOR_PADDING) / EDITOR_LINE_HEIGHT), 0, getLineCount() - 1);
+            int lastLine = math::clamp((int)((args.clipBox.getBottom() - EDITOR_PADDING) / EDITOR_LINE_HEIGHT), 0, getLineCount() - 1);
+            for (int line = firstLine; line <= lastLine; line++)
+            {
+                int start = lineStarts[line];
+                int lineEnd = getLineEnd(line);
+                float y = EDITOR_PADDING + line * EDITOR_LINE_HEIGHT;
 
-            // Draw text field
-            bndTextField(args.vg, 0.0, 0.0, box.size.x, box.size.y, BND_CORNER_ALL, state, -1, text.c_str(), begin, end);
+                // A selection that continues past the line also covers its newline
+                if (begin < end && begin <= lineEnd && end > start)
+                {
+                    float x0 = EDITOR_PADDING + measure(args.vg, start, std::max(begin, start));
+                    float x1 = EDITOR_PADDING + measure(args.vg, start, std::min(end, lineEnd));
+                    if (end > lineEnd)
+                        x1 += EDITOR_FONT_SIZE * 0.5f;
+                    nvgBeginPath(args.vg);
+                    nvgRect(args.vg, x0, y, x1 - x0, EDITOR_LINE_HEIGHT);
+                    nvgFillColor(args.vg, theme->textFieldTheme.itemColor);
+                    nvgFill(args.vg);
+                }
+
+                nvgFillColor(args.vg, textColor);
+                nvgText(args.vg, EDITOR_PADDING, y + 0.5f * (EDITOR_LINE_HEIGHT - EDITOR_FONT_SIZE), text.c_str() + start,
+                        text.c_str() + lineEnd);
+
+                if (state == BND_ACTIVE && cursor >= start && cursor <= lineEnd)
+                {
+                    float x = EDITOR_PADDING + measure(args.vg, start, cursor);
+                    nvgBeginPath(args.vg);
+                    nvgRect(args.vg, x, y, 1.f, EDITOR_LINE_HEIGHT);
+                    nvgFillColor(args.vg, caretColor);
+                    nvgFill(args.vg);
+                }
+            }
 
             nvgResetScissor(args.vg);
         }
 
+        // Maps clicks through the line index, so they match the lines drawn above
+        int getTextPosition(math::Vec mousePos) override
+        {
+            NVGcontext *vg = APP->window->vg;
+            if (!vg || layoutDirty)
+                return ui::TextField::getTextPosition(mousePos);
+
+            int line = math::clamp((int)((mousePos.y - EDITOR_PADDING) / EDITOR_LINE_HEIGHT), 0, getLineCount() - 1);
+            int start = lineStarts[line];
+            int end = getLineEnd(line);
+            if (end <= start)
+                return start;
+
+            setFont(vg);
+            std::vector<NVGglyphPosition> glyphs(end - start);
+            int count = nvgTextGlyphPositions(vg, EDITOR_PADDING, 0.f, text.c_str() + start, text.c_str() + end, glyphs.data(),
+                                              (int)glyphs.size());
+            for (int i = 0; i < count; i++)
+            {
+                if (mousePos.x < 0.5f * (glyphs[i].minx + glyphs[i].maxx))
+                    return (int)(glyphs[i].str - text.c_str());
+            }
+            return end;
+        }
+
         void onChange(const ChangeEvent &e) override
         {
+            layoutDirty = true;
             if (module && module->luabox)
             {
-                module->luabox->scriptString = text;
+                textVersion = module->luabox->setScriptText(text);
             }
         }
     }; // ScriptEditor
@@ -140,7 +275,7 @@ struct LuaBoxEditorWidget : ModuleWidget
 
         ScriptEditorContainer()
         {
-            box.size = Vec(370.f, 335.f);
+            box.size = Vec(370.f, 335.f - CONSOLE_HEIGHT);
             box.pos = Vec(10.f, 25.f);
 
             editor = new ScriptEditor();
@@ -164,6 +299,83 @@ struct LuaBoxEditorWidget : ModuleWidget
         }
     }; // ScriptEditorContainer
 
+    // Read-only view of the LuaBox console, sized to all lines and drawing only the visible ones
+    struct ConsoleView : widget::Widget
+    {
+        LuaBoxEditor *module = nullptr;
+
+        LuaBox *getLuaBox() { return module ? module->luabox : nullptr; }
+
+        void updateSize()
+        {
+            LuaBox *luaBox = getLuaBox();
+            int lines = luaBox ? (int)luaBox->console.size() : 0;
+            box.size.y = std::max(lines * EDITOR_LINE_HEIGHT + 2 * EDITOR_PADDING, CONSOLE_HEIGHT);
+        }
+
+        void draw(const DrawArgs &args) override
+        {
+            nvgBeginPath(args.vg);
+            nvgRect(args.vg, RECT_ARGS(args.clipBox));
+            nvgFillColor(args.vg, nvgRGBA(0x20, 0x20, 0x20, 0xff));
+            nvgFill(args.vg);
+
+            LuaBox *luaBox = getLuaBox();
+            if (!luaBox || luaBox->console.empty())
+                return;
+
+            nvgScissor(args.vg, RECT_ARGS(args.clipBox));
+            nvgFontSize(args.vg, EDITOR_FONT_SIZE);
+            nvgFontFaceId(args.vg, APP->window->uiFont->handle);
+            nvgTextAlign(args.vg, NVG_ALIGN_LEFT | NVG_ALIGN_TOP);
+            nvgFillColor(args.vg, nvgRGBA(215, 225, 240, 0xff));
+            int count = (int)luaBox->console.size();
+            int firstLine = math::clamp((int)((args.clipBox.getTop() - EDITOR_PADDING) / EDITOR_LINE_HEIGHT), 0, count - 1);
+            int lastLine = math::clamp((int)((args.clipBox.getBottom() - EDITOR_PADDING) / EDITOR_LINE_HEIGHT), 0, count - 1);
+            for (int line = firstLine; line <= lastLine; line++)
+            {
+                const std::string &text = luaBox->console[line];
+                float y = EDITOR_PADDING + line * EDITOR_LINE_HEIGHT + 0.5f * (EDITOR_LINE_HEIGHT - EDITOR_FONT_SIZE);
+                nvgText(args.vg, EDITOR_PADDING, y, text.c_str(), text.c_str() + text.size());
+            }
+            nvgResetScissor(args.vg);
+        }
+    }; // ConsoleView
+
+    struct ConsoleContainer : ui::ScrollWidget
+    {
+        ConsoleView *view;
+        uint64_t consoleVersion = 0;
+
+        ConsoleContainer()
+        {
+            box.size = Vec(370.f, CONSOLE_HEIGHT);
+            box.pos = Vec(10.f, 25.f + 335.f - CONSOLE_HEIGHT);
+
+            view = new ConsoleView();
+            view->box.size = Vec(370.f, CONSOLE_HEIGHT);
+            container->addChild(view);
+            containerBox = view->box;
+        }
+
+        void step() override
+        {
+            // Follow new lines while scrolled to the bottom, ScrollWidget clamps the offset
+            LuaBox *luaBox = view->getLuaBox();
+            bool atBottom = offset.y >= containerBox.size.y - box.size.y - EDITOR_LINE_HEIGHT;
+            view->updateSize();
+            containerBox = view->box;
+            if (luaBox && luaBox->consoleVersion != consoleVersion)
+            {
+                if (atBottom)
+                    offset.y = containerBox.size.y;
+                consoleVersion = luaBox->consoleVersion;
+            }
+
+            ui::ScrollWidget::step();
+        }
+    }; // ConsoleContainer
+
     LuaBoxEditorWidget(LuaBoxEditor *module)
     {
         setModule(module);
@@ -180,6 +392,11 @@ struct LuaBoxEditorWidget : ModuleWidget
         scriptContainer->module = module;
         scriptContainer->editor->multiline = true;
         addChild(scriptContainer);
+
+        // Add console for script output
+        ConsoleContainer *consoleContainer = new ConsoleContainer();
+        consoleContainer->view->module = module;
+        addChild(consoleContainer);
     }
 };
 
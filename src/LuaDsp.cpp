@@ -0,0 +1,592 @@
+// LuaDsp.cpp
+
+#include "LuaDsp.hpp"
+#include "LuaScript.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// Every object starts with this header, so one finalizer frees them all
+// Buffers are a separate power-of-two allocation, which fills its arena size class exactly
+struct DspHeader
+{
+    LuaDspApi *api;
+    size_t size;
+    void *data;
+    size_t dataSize;
+
+    float sampleRate() const { return api->block->samplerate; }
+};
+
+template <typename T>
+static T *newObject(LuaDspApi *api, size_t dataSize = 0)
+{
+    T *object = static_cast<T *>(api->alloc(api->ud, nullptr, 0, sizeof(T)));
+    if (!object)
+        return nullptr;
+    std::memset(object, 0, sizeof(T));
+    object->header.api = api;
+    object->header.size = sizeof(T);
+
+    if (dataSize > 0)
+    {
+        object->header.data = api->alloc(api->ud, nullptr, 0, dataSize);
+        if (!object->header.data)
+        {
+            api->alloc(api->ud, object, sizeof(T), 0);
+            return nullptr;
+        }
+        std::memset(object->header.data, 0, dataSize);
+        object->header.dataSize = dataSize;
+    }
+    return object;
+}
+
+static void freeObject(void *object)
+{
+    DspHeader *header = static_cast<DspHeader *>(object);
+    if (header->data)
+        header->api->alloc(header->api->ud, header->data, header->dataSize, 0);
+    header->api->alloc(header->api->ud, object, header->size, 0);
+}
+
+// Keeps frequencies below Nyquist so the filter coefficients stay stable
+static float clampFreq(float freq, float sampleRate) { return std::min(std::max(freq, 1.f), 0.49f * sampleRate); }
+
+// Biquad from the RBJ cookbook in transposed direct form II
+
+enum BiquadMode
+{
+    BIQUAD_LOWPASS,
+    BIQUAD_HIGHPASS,
+    BIQUAD_BANDPASS,
+    BIQUAD_NOTCH,
+    BIQUAD_PEAK,
+    BIQUAD_LOWSHELF,
+    BIQUAD_HIGHSHELF,
+    BIQUAD_ALLPASS
+};
+
+struct LuaDspBiquad
+{
+    DspHeader header;
+    int mode;
+    float b0, b1, b2, a1, a2;
+    float z1, z2;
+};
+
+static LuaDspBiquad *biquad_new(LuaDspApi *api, int mode)
+{
+    LuaDspBiquad *b = newObject<LuaDspBiquad>(api);
+    if (b)
+    {
+        b->mode = mode;
+        b->b0 = 1.f;
+    }
+    return b;
+}
+
+static void biquad_set(LuaDspBiquad *b, float freq, float q, float gain)
+{
+    float fs = b->header.sampleRate();
+    float w0 = 2.f * (float)M_PI * clampFreq(freq, fs) / fs;
+    float cosw = std::cos(w0);
+    float alpha = std::sin(w0) / (2.f * std::max(q, 0.01f));
+    float A = std::pow(10.f, gain / 40.f);
+    float sqrtA2alpha = 2.f * std::sqrt(A) * alpha;
+
+    float b0, b1, b2, a0, a1, a2;
+    switch (b->mode)
+    {
+    default:
+    case BIQUAD_LOWPASS:
+        b0 = (1.f - cosw) / 2.f, b1 = 1.f - cosw, b2 = b0;
+        a0 = 1.f + alpha, a1 = -2.f * cosw, a2 = 1.f - alpha;
+        break;
+    case BIQUAD_HIGHPASS:
+        b0 = (1.f + cosw) / 2.f, b1 = -(1.f + cosw), b2 = b0;
+        a0 = 1.f + alpha, a1 = -2.f * cosw, a2 = 1.f - alpha;
+        break;
+    case BIQUAD_BANDPASS:
+        b0 = alpha, b1 = 0.f, b2 = -alpha;
+        a0 = 1.f + alpha, a1 = -2.f * cosw, a2 = 1.f - alpha;
+        break;
+    case BIQUAD_NOTCH:
+        b0 = 1.f, b1 = -2.f * cosw, b2 = 1.f;
+        a0 = 1.f + alpha, a1 = -2.f * cosw, a2 = 1.f - alpha;
+        break;
+    case BIQUAD_PEAK:
+        b0 = 1.f + alpha * A, b1 = -2.f * cosw, b2 = 1.f - alpha * A;
+        a0 = 1.f + alpha / A, a1 = -2.f * cosw, a2 = 1.f - alpha / A;
+        break;
+    case BIQUAD_LOWSHELF:
+        b0 = A * ((A + 1.f) - (A - 1.f) * cosw + sqrtA2alpha);
+        b1 = 2.f * A * ((A - 1.f) - (A + 1.f) * cosw);
+        b2 = A * ((A + 1.f) - (A - 1.f) * cosw - sqrtA2alpha);
+        a0 = (A + 1.f) + (A - 1.f) * cosw + sqrtA2alpha;
+        a1 = -2.f * ((A - 1.f) + (A + 1.f) * cosw);
+        a2 = (A + 1.f) + (A - 1.f) * cosw - sqrtA2alpha;
+        break;
+    case BIQUAD_HIGHSHELF:
+        b0 = A * ((A + 1.f) + (A - 1.f) * cosw + sqrtA2alpha);
+        b1 = -2.f * A * ((A - 1.f) + (A + 1.f) * cosw);
+        b2 = A * ((A + 1.f) + (A - 1.f) * cosw - sqrtA2alpha);
+        a0 = (A + 1.f) - (A - 1.f) * cosw + sqrtA2alpha;
+        a1 = 2.f * ((A - 1.f) - (A + 1.f) * cosw);
+        a2 = (A + 1.f) - (A - 1.f) * cosw - sqrtA2alpha;
+        break;
+    case BIQUAD_ALLPASS:
+        b0 = 1.f - alpha, b1 = -2.f * cosw, b2 = 1.f + alpha;
+        a0 = 1.f + alpha, a1 = -2.f * cosw, a2 = 1.f - alpha;
+        break;
+    }
+
+    b->b0 = b0 / a0, b->b1 = b1 / a0, b->b2 = b2 / a0;
+    b->a1 = a1 / a0, b->a2 = a2 / a0;
+}
+
+static float biquad_process(LuaDspBiquad *b, float x)
+{
+    float y = b->b0 * x + b->z1;
+    b->z1 = b->b1 * x - b->a1 * y + b->z2;
+    b->z2 = b->b2 * x - b->a2 * y;
+    return y;
+}
+
+static void biquad_reset(LuaDspBiquad *b)
+{
+    b->z1 = b->z2 = 0.f;
+}
+
+// State variable filter, trapezoidal integration after Andrew Simper
+
+struct LuaDspSvf
+{
+    DspHeader header;
+    float k, a1, a2, a3;
+    float ic1, ic2;
+    float lp, bp, hp;
+};
+
+static void svf_set(LuaDspSvf *s, float freq, float q)
+{
+    float fs = s->header.sampleRate();
+    float g = std::tan((float)M_PI * clampFreq(freq, fs) / fs);
+    s->k = 1.f / std::max(q, 0.01f);
+    s->a1 = 1.f / (1.f + g * (g + s->k));
+    s->a2 = g * s->a1;
+    s->a3 = g * s->a2;
+}
+
+static LuaDspSvf *svf_new(LuaDspApi *api)
+{
+    LuaDspSvf *s = newObject<LuaDspSvf>(api);
+    if (s)
+        svf_set(s, 1000.f, 0.7071f);
+    return s;
+}
+
+static float svf_process(LuaDspSvf *s, float x)
+{
+    float v3 = x - s->ic2;
+    float v1 = s->a1 * s->ic1 + s->a2 * v3;
+    float v2 = s->ic2 + s->a2 * s->ic1 + s->a3 * v3;
+    s->ic1 = 2.f * v1 - s->ic1;
+    s->ic2 = 2.f * v2 - s->ic2;
+    s->lp = v2;
+    s->bp = v1;
+    s->hp = x - s->k * v1 - v2;
+    return s->lp;
+}
+
+static float svf_bandpass(LuaDspSvf *s) { return s->bp; }
+static float svf_highpass(LuaDspSvf *s) { return s->hp; }
+
+static void svf_reset(LuaDspSvf *s)
+{
+    s->ic1 = s->ic2 = s->lp = s->bp = s->hp = 0.f;
+}
+
+// Trapezoidal one-pole lowpass, the highpass is the input minus the lowpass
+
+struct LuaDspOnepole
+{
+    DspHeader header;
+    float g;
+    float s;
+    float lp, hp;
+};
+
+static void onepole_set(LuaDspOnepole *o, float freq)
+{
+    float fs = o->header.sampleRate();
+    float g = std::tan((float)M_PI * clampFreq(freq, fs) / fs);
+    o->g = g / (1.f + g);
+}
+
+static LuaDspOnepole *onepole_new(LuaDspApi *api)
+{
+    LuaDspOnepole *o = newObject<LuaDspOnepole>(api);
+    if (o)
+        onepole_set(o, 1000.f);
+    return o;
+}
+
+static float onepole_process(LuaDspOnepole *o, float x)
+{
+    float v = (x - o->s) * o->g;
+    o->lp = v + o->s;
+    o->s = o->lp + v;
+    o->hp = x - o->lp;
+    return o->lp;
+}
+
+static float onepole_highpass(LuaDspOnepole *o) { return o->hp; }
+
+static void onepole_reset(LuaDspOnepole *o)
+{
+    o->s = o->lp = o->hp = 0.f;
+}
+
+// Delay line on a power-of-two ring buffer
+
+enum DelayInterpolation
+{
+    DELAY_NEAREST,
+    DELAY_LINEAR,
+    DELAY_HERMITE
+};
+
+struct LuaDspDelay
+{
+    DspHeader header;
+    int length;
+    int interpolation;
+    unsigned mask;
+    unsigned pos;
+    float *buffer;
+};
+
+static LuaDspDelay *delay_new(LuaDspApi *api, int length, int interpolation)
+{
+    length = std::max(length, 1);
+    unsigned size = 4;
+    while (size < (unsigned)length + 4)
+        size <<= 1;
+
+    LuaDspDelay *d = newObject<LuaDspDelay>(api, size * sizeof(float));
+    if (d)
+    {
+        d->buffer = static_cast<float *>(d->header.data);
+        d->length = length;
+        d->interpolation = interpolation;
+        d->mask = size - 1;
+    }
+    return d;
+}
+
+static void delay_write(LuaDspDelay *d, float x)
+{
+    d->buffer[d->pos] = x;
+    d->pos = (d->pos + 1) & d->mask;
+}
+
+// Sample written `n` samples ago, 1 is the most recent
+static inline float delayTap(const LuaDspDelay *d, int n) { return d->buffer[(d->pos - n) & d->mask]; }
+
+// Reads `delay` samples back, 1 is the most recently written sample
+static float delay_read(LuaDspDelay *d, float delay)
+{
+    float minDelay = d->interpolation == DELAY_HERMITE ? 2.f : 1.f;
+    delay = std::min(std::max(delay, minDelay), (float)d->length);
+
+    int n = (int)delay;
+    float t = delay - n;
+    switch (d->interpolation)
+    {
+    case DELAY_NEAREST:
+        return delayTap(d, (int)(delay + 0.5f));
+    default:
+    case DELAY_LINEAR:
+        return delayTap(d, n) + t * (delayTap(d, n + 1) - delayTap(d, n));
+    case DELAY_HERMITE:
+    {
+        float y0 = delayTap(d, n - 1), y1 = delayTap(d, n), y2 = delayTap(d, n + 1), y3 = delayTap(d, n + 2);
+        float c1 = 0.5f * (y2 - y0);
+        float c2 = y0 - 2.5f * y1 + 2.f * y2 - 0.5f * y3;
+        float c3 = 0.5f * (y3 - y0) + 1.5f * (y1 - y2);
+        return ((c3 * t + c2) * t + c1) * t + y1;
+    }
+    }
+}
+
+// Reads the delayed sample, then writes the input plus feedback
+static float delay_process(LuaDspDelay *d, float x, float delay, float feedback)
+{
+    float y = delay_read(d, delay);
+    delay_write(d, x + y * feedback);
+    return y;
+}
+
+static int delay_length(LuaDspDelay *d) { return d->length; }
+
+static void delay_reset(LuaDspDelay *d)
+{
+    std::memset(d->buffer, 0, (d->mask + 1) * sizeof(float));
+    d->pos = 0;
+}
+
+// Oscillator with PolyBLEP corrected saw and pulse
+
+enum OscWave
+{
+    OSC_SINE,
+    OSC_SAW,
+    OSC_SQUARE,
+    OSC_TRIANGLE
+};
+
+struct LuaDspOsc
+{
+    DspHeader header;
+    int wave;
+    float phase;
+    float freq;
+    float width;
+};
+
+static inline float polyBlep(float t, float dt)
+{
+    if (t < dt)
+    {
+        t /= dt;
+        return t + t - t * t - 1.f;
+    }
+    if (t > 1.f - dt)
+    {
+        t = (t - 1.f) / dt;
+        return t * t + t + t + 1.f;
+    }
+    return 0.f;
+}
+
+static LuaDspOsc *osc_new(LuaDspApi *api, int wave)
+{
+    LuaDspOsc *o = newObject<LuaDspOsc>(api);
+    if (o)
+    {
+        o->wave = wave;
+        o->freq = 261.6256f;
+        o->width = 0.5f;
+    }
+    return o;
+}
+
+static void osc_set(LuaDspOsc *o, float freq) { o->freq = freq; }
+
+static void osc_pulsewidth(LuaDspOsc *o, float width) { o->width = std::min(std::max(width, 0.01f), 0.99f); }
+
+static float osc_process(LuaDspOsc *o)
+{
+    float dt = std::min(std::fabs(o->freq) / o->header.sampleRate(), 0.49f);
+    float t = o->phase;
+
+    float y;
+    switch (o->wave)
+    {
+    default:
+    case OSC_SINE:
+        y = std::sin(2.f * (float)M_PI * t);
+        break;
+    case OSC_SAW:
+        y = 2.f * t - 1.f - polyBlep(t, dt);
+        break;
+    case OSC_SQUARE:
+    {
+        float t2 = t + 1.f - o->width;
+        t2 -= (int)t2;
+        y = (t < o->width ? 1.f : -1.f) + polyBlep(t, dt) - polyBlep(t2, dt);
+        break;
+    }
+    case OSC_TRIANGLE:
+        // Triangle harmonics fall off at 12 dB per octave, so it is left naive
+        y = 4.f * std::fabs(t - 0.5f) - 1.f;
+        break;
+    }
+
+    o->phase += dt;
+    if (o->phase >= 1.f)
+        o->phase -= 1.f;
+    return y;
+}
+
+static void osc_reset(LuaDspOsc *o, float phase)
+{
+    phase -= std::floor(phase);
+    o->phase = phase;
+}
+
+// Slew limiter, times are for a 10 V change
+
+struct LuaDspSlew
+{
+    DspHeader header;
+    float rise, fall;
+    float value;
+};
+
+static LuaDspSlew *slew_new(LuaDspApi *api) { return newObject<LuaDspSlew>(api); }
+
+static void slew_set(LuaDspSlew *s, float rise, float fall)
+{
+    s->rise = std::max(rise, 0.f);
+    s->fall = std::max(fall, 0.f);
+}
+
+static float slew_process(LuaDspSlew *s, float x)
+{
+    float fs = s->header.sampleRate();
+    if (x > s->value)
+        s->value = s->rise > 0.f ? std::min(x, s->value + 10.f / (s->rise * fs)) : x;
+    else
+        s->value = s->fall > 0.f ? std::max(x, s->value - 10.f / (s->fall * fs)) : x;
+    return s->value;
+}
+
+static void slew_reset(LuaDspSlew *s, float value) { s->value = value; }
+
+// ADSR with a linear attack and exponential decay and release, output 0 to 1
+
+struct LuaDspAdsr
+{
+    DspHeader header;
+    float attack, decay, sustain, release;
+    float attackStep, decayCoef, releaseCoef;
+    float coefRate;
+    float level;
+    int stage; // 0 idle, 1 attack, 2 decay/sustain, 3 release
+    bool gate;
+};
+
+static float expCoef(float time, float fs) { return time > 0.f ? 1.f - std::exp(-1.f / (time * fs)) : 1.f; }
+
+static void adsrUpdate(LuaDspAdsr *a, float fs)
+{
+    a->attackStep = a->attack > 0.f ? 1.f / (a->attack * fs) : 1.f;
+    a->decayCoef = expCoef(a->decay, fs);
+    a->releaseCoef = expCoef(a->release, fs);
+    a->coefRate = fs;
+}
+
+static void adsr_set(LuaDspAdsr *a, float attack, float decay, float sustain, float release)
+{
+    a->attack = std::max(attack, 0.f);
+    a->decay = std::max(decay, 0.f);
+    a->sustain = std::min(std::max(sustain, 0.f), 1.f);
+    a->release = std::max(release, 0.f);
+    adsrUpdate(a, a->header.sampleRate());
+}
+
+static LuaDspAdsr *adsr_new(LuaDspApi *api)
+{
+    LuaDspAdsr *a = newObject<LuaDspAdsr>(api);
+    if (a)
+        adsr_set(a, 0.01f, 0.1f, 0.5f, 0.2f);
+    return a;
+}
+
+static float adsr_process(LuaDspAdsr *a, float gate)
+{
+    float fs = a->header.sampleRate();
+    if (fs != a->coefRate)
+        adsrUpdate(a, fs);
+
+    bool high = gate > 0.f;
+    if (high && !a->gate)
+        a->stage = 1;
+    else if (!high && a->gate)
+        a->stage = 3;
+    a->gate = high;
+
+    switch (a->stage)
+    {
+    case 1:
+        a->level += a->attackStep;
+        if (a->level >= 1.f)
+        {
+            a->level = 1.f;
+            a->stage = 2;
+        }
+        break;
+    case 2:
+        a->level += (a->sustain - a->level) * a->decayCoef;
+        break;
+    case 3:
+        a->level -= a->level * a->releaseCoef;
+        if (a->level < 1e-5f)
+        {
+            a->level = 0.f;
+            a->stage = 0;
+        }
+        break;
+    default:
+        break;
+    }
+    return a->level;
+}
+
+static void adsr_reset(LuaDspAdsr *a)
+{
+    a->level = 0.f;
+    a->stage = 0;
+    a->gate = false;
+}
+
+void initDspApi(LuaDspApi &api, void *(*alloc)(void *, void *, size_t, size_t), void *ud, const LuaProcessBlock *block)
+{
+    api.alloc = alloc;
+    api.ud = ud;
+    api.block = block;
+    api.free = freeObject;
+
+    api.biquad_new = biquad_new;
+    api.biquad_set = biquad_set;
+    api.biquad_process = biquad_process;
+    api.biquad_reset = biquad_reset;
+
+    api.svf_new = svf_new;
+    api.svf_set = svf_set;
+    api.svf_process = svf_process;
+    api.svf_bandpass = svf_bandpass;
+    api.svf_highpass = svf_highpass;
+    api.svf_reset = svf_reset;
+
+    api.onepole_new = onepole_new;
+    api.onepole_set = onepole_set;
+    api.onepole_process = onepole_process;
+    api.onepole_highpass = onepole_highpass;
+    api.onepole_reset = onepole_reset;
+
+    api.delay_new = delay_new;
+    api.delay_write = delay_write;
+    api.delay_read = delay_read;
+    api.delay_process = delay_process;
+    api.delay_length = delay_length;
+    api.delay_reset = delay_reset;
+
+    api.osc_new = osc_new;
+    api.osc_set = osc_set;
+    api.osc_pulsewidth = osc_pulsewidth;
+    api.osc_process = osc_process;
+    api.osc_reset = osc_reset;
+
+    api.slew_new = slew_new;
+    api.slew_set = slew_set;
+    api.slew_process = slew_process;
+    api.slew_reset = slew_reset;
+
+    api.adsr_new = adsr_new;
+    api.adsr_set = adsr_set;
+    api.adsr_process = adsr_process;
+    api.adsr_reset = adsr_reset;
+}
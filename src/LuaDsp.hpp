@@ -0,0 +1,77 @@
+// LuaDsp.hpp
+
+#pragma once
+
+#include <cstddef>
+
+struct LuaProcessBlock;
+
+// Native DSP objects for scripts, called from `res/lua/dsp.lua` through FFI
+// Plugin symbols are not visible to `ffi.C`, so the functions are handed to Lua as a table of pointers
+// The layout must match the cdef in `res/lua/dsp.lua`
+extern "C" {
+
+// Each object type is its own struct, so FFI rejects an object passed to another type's method
+struct LuaDspBiquad;
+struct LuaDspSvf;
+struct LuaDspOnepole;
+struct LuaDspDelay;
+struct LuaDspOsc;
+struct LuaDspSlew;
+struct LuaDspAdsr;
+
+struct LuaDspApi
+{
+    // Allocator of the owning Lua state, so objects live in the script's arena and count against its limit
+    void *(*alloc)(void *ud, void *ptr, size_t osize, size_t nsize);
+    void *ud;
+    const LuaProcessBlock *block;
+
+    void (*free)(void *object);
+
+    LuaDspBiquad *(*biquad_new)(LuaDspApi *api, int mode);
+    void (*biquad_set)(LuaDspBiquad *b, float freq, float q, float gain);
+    float (*biquad_process)(LuaDspBiquad *b, float x);
+    void (*biquad_reset)(LuaDspBiquad *b);
+
+    LuaDspSvf *(*svf_new)(LuaDspApi *api);
+    void (*svf_set)(LuaDspSvf *s, float freq, float q);
+    float (*svf_process)(LuaDspSvf *s, float x);
+    float (*svf_bandpass)(LuaDspSvf *s);
+    float (*svf_highpass)(LuaDspSvf *s);
+    void (*svf_reset)(LuaDspSvf *s);
+
+    LuaDspOnepole *(*onepole_new)(LuaDspApi *api);
+    void (*onepole_set)(LuaDspOnepole *o, float freq);
+    float (*onepole_process)(LuaDspOnepole *o, float x);
+    float (*onepole_highpass)(LuaDspOnepole *o);
+    void (*onepole_reset)(LuaDspOnepole *o);
+
+    LuaDspDelay *(*delay_new)(LuaDspApi *api, int length, int interpolation);
+    void (*delay_write)(LuaDspDelay *d, float x);
+    float (*delay_read)(LuaDspDelay *d, float delay);
+    float (*delay_process)(LuaDspDelay *d, float x, float delay, float feedback);
+    int (*delay_length)(LuaDspDelay *d);
+    void (*delay_reset)(LuaDspDelay *d);
+
+    LuaDspOsc *(*osc_new)(LuaDspApi *api, int wave);
+    void (*osc_set)(LuaDspOsc *o, float freq);
+    void (*osc_pulsewidth)(LuaDspOsc *o, float width);
+    float (*osc_process)(LuaDspOsc *o);
+    void (*osc_reset)(LuaDspOsc *o, float phase);
+
+    LuaDspSlew *(*slew_new)(LuaDspApi *api);
+    void (*slew_set)(LuaDspSlew *s, float rise, float fall);
+    float (*slew_process)(LuaDspSlew *s, float x);
+    void (*slew_reset)(LuaDspSlew *s, float value);
+
+    LuaDspAdsr *(*adsr_new)(LuaDspApi *api);
+    void (*adsr_set)(LuaDspAdsr *a, float attack, float decay, float sustain, float release);
+    float (*adsr_process)(LuaDspAdsr *a, float gate);
+    void (*adsr_reset)(LuaDspAdsr *a);
+};
+
+} // extern "C"
+
+// Fills the function table for a state using `alloc` and `ud`, objects read the sample rate from `block`
+void initDspApi(LuaDspApi &api, void *(*alloc)(void *, void *, size_t, size_t), void *ud, const LuaProcessBlock *block);
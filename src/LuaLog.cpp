@@ -0,0 +1,24 @@
+// LuaLog.cpp
+
+#include "LuaLog.hpp"
+#include <chrono>
+
+constexpr int LuaLogMessage::MAX_LENGTH;
+constexpr int LuaLogBuffer::RATE_LIMIT;
+
+// Fixed one second windows, enough to keep a `print()` in `process()` from flooding the log
+bool LuaLogBuffer::push(const LuaLogMessage &message)
+{
+    using namespace std::chrono;
+    int64_t now = duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+    int64_t start = windowStart.load(std::memory_order_relaxed);
+    if (now - start >= 1000 && windowStart.compare_exchange_strong(start, now, std::memory_order_relaxed))
+        windowCount.store(0, std::memory_order_relaxed);
+
+    if (windowCount.fetch_add(1, std::memory_order_relaxed) >= RATE_LIMIT || !queue.push(message))
+    {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,37 @@
+// LuaLog.hpp
+
+#pragma once
+
+#include "LuaQueue.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// One line from `print()` or `log.*()`, levels follow Rack's logger (0 debug, 1 info, 2 warn)
+struct LuaLogMessage
+{
+    static constexpr int MAX_LENGTH = 240;
+    int level;
+    int length;
+    char text[MAX_LENGTH];
+};
+
+// Log lines of one module on their way from the script to the UI thread
+// Scripts push from the audio thread or a worker without locking or allocating, the UI thread drains it
+// Lines over the rate limit or that don't fit are dropped and counted
+struct LuaLogBuffer
+{
+    static constexpr int RATE_LIMIT = 100; // lines per second
+
+    bool push(const LuaLogMessage &message);
+    bool pop(LuaLogMessage &message) { return queue.pop(message); }
+
+    // Lines dropped since the last call
+    uint32_t takeDropped() { return dropped.exchange(0, std::memory_order_relaxed); }
+
+  private:
+    LuaQueue<LuaLogMessage, 256> queue;
+    std::atomic<uint32_t> dropped{0};
+    std::atomic<int64_t> windowStart{0};
+    std::atomic<int> windowCount{0};
+};
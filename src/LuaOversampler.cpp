@@ -0,0 +1,119 @@
+// LuaOversampler.cpp
+
+#include "LuaOversampler.hpp"
+#include <algorithm>
+#include <cmath>
+
+constexpr int LuaOversampler::MAX_FACTOR;
+constexpr int LuaOversampler::QUALITY;
+constexpr int LuaOversampler::MAX_TAPS;
+
+// Windowed sinc lowpass at the base rate's Nyquist frequency, normalized to unity gain
+static void makeKernel(float *kernel, int factor)
+{
+    int taps = factor * LuaOversampler::QUALITY;
+    double cutoff = 0.5 / factor;
+    double center = 0.5 * (taps - 1);
+    double sum = 0.0;
+    for (int i = 0; i < taps; i++)
+    {
+        double t = i - center;
+        double sinc = t == 0.0 ? 2.0 * cutoff : std::sin(2.0 * M_PI * cutoff * t) / (M_PI * t);
+
+        // Blackman-Harris window, same as Rack's oversamplers
+        double p = 2.0 * M_PI * (i + 0.5) / taps;
+        double window = 0.35875 - 0.48829 * std::cos(p) + 0.14128 * std::cos(2.0 * p) - 0.01168 * std::cos(3.0 * p);
+
+        kernel[i] = (float)(sinc * window);
+        sum += kernel[i];
+    }
+    for (int i = 0; i < taps; i++)
+        kernel[i] = (float)(kernel[i] / sum);
+}
+
+// Built once for every factor, the tables are shared by all instances
+const float *LuaOversampler::getKernel(int factor)
+{
+    struct Kernels
+    {
+        float kernels[4][MAX_TAPS];
+        Kernels()
+        {
+            for (int i = 1; i < 4; i++)
+                makeKernel(kernels[i], 1 << i);
+        }
+    };
+    static const Kernels table;
+    switch (factor)
+    {
+    case 2:
+        return table.kernels[1];
+    case 4:
+        return table.kernels[2];
+    case 8:
+        return table.kernels[3];
+    default:
+        return nullptr;
+    }
+}
+
+void LuaOversampler::setFactor(int factor)
+{
+    this->factor = factor;
+    kernel = getKernel(factor);
+    reset();
+}
+
+void LuaOversampler::reset()
+{
+    std::fill(upHistory, upHistory + 2 * QUALITY, 0.f);
+    std::fill(downHistory, downHistory + 2 * MAX_TAPS, 0.f);
+    upPos = 0;
+    downPos = 0;
+}
+
+// Branch `p` of the kernel interpolates output phase `p`, the gain of `factor` makes up for the inserted zeros
+void LuaOversampler::upsample(float x, float *out)
+{
+    if (!kernel)
+    {
+        std::fill(out, out + factor, x);
+        return;
+    }
+
+    upPos = (upPos + QUALITY - 1) % QUALITY;
+    upHistory[upPos] = upHistory[upPos + QUALITY] = x;
+    const float *history = upHistory + upPos;
+    for (int p = 0; p < factor; p++)
+    {
+        float y = 0.f;
+        for (int k = 0; k < QUALITY; k++)
+            y += kernel[k * factor + p] * history[k];
+        out[p] = y * factor;
+    }
+}
+
+// Only every `factor`th output of the filter is needed, so it is computed once per call
+float LuaOversampler::downsample(const float *in)
+{
+    if (!kernel)
+        return in[factor - 1];
+
+    int taps = factor * QUALITY;
+    for (int i = 0; i < factor; i++)
+    {
+        downPos = (downPos + taps - 1) % taps;
+        downHistory[downPos] = downHistory[downPos + taps] = in[i];
+    }
+    const float *history = downHistory + downPos;
+    float y = 0.f;
+    for (int k = 0; k < taps; k++)
+        y += kernel[k] * history[k];
+    return y;
+}
+
+// Each filter delays by half its length at the oversampled rate, together a whole number of base samples
+int LuaOversampler::getLatency(int factor)
+{
+    return factor > 1 ? QUALITY - 1 : 0;
+}
@@ -0,0 +1,38 @@
+// LuaOversampler.hpp
+
+#pragma once
+
+// Polyphase FIR up- and downsampling of one signal by 2, 4 or 8
+// Rack's dsp::Upsampler and dsp::Decimator fix the factor at compile time, this one is chosen per script
+struct LuaOversampler
+{
+    static constexpr int MAX_FACTOR = 8;
+    // Taps per polyphase branch, the kernel has `factor * QUALITY` taps
+    static constexpr int QUALITY = 8;
+    static constexpr int MAX_TAPS = MAX_FACTOR * QUALITY;
+
+    // Also clears the history
+    void setFactor(int factor);
+    void reset();
+
+    // Writes `factor` samples at the oversampled rate for one input sample
+    void upsample(float x, float *out);
+
+    // Reads `factor` samples at the oversampled rate and returns one output sample
+    float downsample(const float *in);
+
+    // Delay of upsampling followed by downsampling, in samples at the base rate
+    static int getLatency(int factor);
+
+  private:
+    int factor = 1;
+    const float *kernel = nullptr;
+
+    // Histories are stored twice in a row, so the newest `length` samples are always contiguous
+    float upHistory[2 * QUALITY] = {};
+    float downHistory[2 * MAX_TAPS] = {};
+    int upPos = 0;
+    int downPos = 0;
+
+    static const float *getKernel(int factor);
+};
@@ -0,0 +1,34 @@
+// LuaPreludes.cpp
+
+#include "LuaPreludes.hpp"
+#include <cstring>
+
+// The Makefile generates these headers with `luajit -b` when it can run the LuaJIT it built,
+// otherwise the preludes are read from `res/lua` at load time
+#ifdef LUABOX_EMBEDDED_PRELUDES
+#include "util.h"
+#include "ffi.h"
+#include "dsp.h"
+#include "array.h"
+#include "sample.h"
+
+static const LuaPrelude preludes[] = {
+    {"util.lua", luaJIT_BC_util, luaJIT_BC_util_SIZE},
+    {"ffi.lua", luaJIT_BC_ffi, luaJIT_BC_ffi_SIZE},
+    {"dsp.lua", luaJIT_BC_dsp, luaJIT_BC_dsp_SIZE},
+    {"array.lua", luaJIT_BC_array, luaJIT_BC_array_SIZE},
+    {"sample.lua", luaJIT_BC_sample, luaJIT_BC_sample_SIZE},
+};
+#else
+static const LuaPrelude preludes[] = {{nullptr, nullptr, 0}};
+#endif
+
+const LuaPrelude *findPrelude(const char *name)
+{
+    for (const LuaPrelude &prelude : preludes)
+    {
+        if (prelude.name && !std::strcmp(prelude.name, name))
+            return &prelude;
+    }
+    return nullptr;
+}
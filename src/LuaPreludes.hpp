@@ -0,0 +1,16 @@
+// LuaPreludes.hpp
+
+#pragma once
+
+#include <cstddef>
+
+// Library scripts from `res/lua` compiled to LuaJIT bytecode at build time
+struct LuaPrelude
+{
+    const char *name;
+    const unsigned char *bytecode;
+    size_t size;
+};
+
+// Returns the embedded prelude for a file name like "util.lua", or nullptr when it was not embedded
+const LuaPrelude *findPrelude(const char *name);
@@ -0,0 +1,87 @@
+// LuaProfiler.cpp
+
+#include "LuaProfiler.hpp"
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+uint64_t LuaProfiler::getNanoseconds()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void LuaProfiler::reset()
+{
+    calls.store(0, std::memory_order_release);
+    gcTime.store(0.f, std::memory_order_relaxed);
+}
+
+void LuaProfiler::recordCall(uint64_t ns)
+{
+    uint64_t n = calls.load(std::memory_order_relaxed);
+    history[n % HISTORY].store((uint32_t)std::min<uint64_t>(ns, UINT32_MAX), std::memory_order_relaxed);
+    calls.store(n + 1, std::memory_order_release);
+}
+
+// GC time is smoothed over roughly a hundred blocks
+void LuaProfiler::recordGarbage(float us, int memoryKB, int peakKB)
+{
+    float average = gcTime.load(std::memory_order_relaxed);
+    gcTime.store(average + 0.01f * (us - average), std::memory_order_relaxed);
+    gcMemory.store(memoryKB, std::memory_order_relaxed);
+    memoryPeak.store(peakKB, std::memory_order_relaxed);
+}
+
+void LuaProfiler::recordJit(const LuaJitStats &stats)
+{
+    jitEnabled.store(stats.enabled, std::memory_order_relaxed);
+    jitTraces.store(stats.traces, std::memory_order_relaxed);
+    jitAborts.store(stats.aborts, std::memory_order_relaxed);
+    jitFlushes.store(stats.flushes, std::memory_order_relaxed);
+}
+
+void LuaProfiler::updateRate(double now)
+{
+    uint64_t n = calls.load(std::memory_order_acquire);
+    if (n < lastCalls)
+        lastCalls = 0;
+    if (now - lastTime < 0.5)
+        return;
+    if (lastTime > 0.0)
+        lastRate = (n - lastCalls) / (now - lastTime);
+    lastCalls = n;
+    lastTime = now;
+}
+
+LuaProfiler::Stats LuaProfiler::snapshot()
+{
+    Stats stats;
+    stats.calls = calls.load(std::memory_order_acquire);
+    stats.gcTime = gcTime.load(std::memory_order_relaxed);
+    stats.gcMemory = gcMemory.load(std::memory_order_relaxed);
+    stats.memoryPeak = memoryPeak.load(std::memory_order_relaxed);
+    stats.jit.enabled = jitEnabled.load(std::memory_order_relaxed);
+    stats.jit.traces = jitTraces.load(std::memory_order_relaxed);
+    stats.jit.aborts = jitAborts.load(std::memory_order_relaxed);
+    stats.jit.flushes = jitFlushes.load(std::memory_order_relaxed);
+    stats.callsPerSecond = lastRate;
+
+    // Entries may be overwritten while copying, which only mixes in newer calls
+    int count = (int)std::min<uint64_t>(stats.calls, HISTORY);
+    if (count == 0)
+        return stats;
+    std::vector<uint32_t> samples(count);
+    for (int i = 0; i < count; i++)
+        samples[i] = history[(stats.calls - 1 - i) % HISTORY].load(std::memory_order_relaxed);
+
+    double sum = 0.0;
+    for (uint32_t ns : samples)
+        sum += ns;
+    stats.meanNs = sum / count;
+
+    std::sort(samples.begin(), samples.end());
+    stats.minNs = samples.front();
+    stats.maxNs = samples.back();
+    stats.p99Ns = samples[std::min(count - 1, (int)(count * 0.99))];
+    return stats;
+}
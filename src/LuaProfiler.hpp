@@ -0,0 +1,65 @@
+// LuaProfiler.hpp
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Trace events counted by the `jit.attach()` handler in `ffi.lua`, written by Lua through FFI
+struct LuaJitStats
+{
+    int enabled;
+    int traces;
+    int aborts;
+    int flushes;
+};
+
+// Timing of a script's calls, written by the audio thread and read by the UI thread without locks
+// Durations go into a ring buffer indexed by the call counter, readers copy the latest entries
+struct LuaProfiler
+{
+    static constexpr int HISTORY = 1024;
+
+    struct Stats
+    {
+        uint64_t calls = 0;
+        double callsPerSecond = 0.0;
+        double minNs = 0.0;
+        double meanNs = 0.0;
+        double p99Ns = 0.0;
+        double maxNs = 0.0;
+        float gcTime = 0.f;
+        int gcMemory = 0;
+        int memoryPeak = 0;
+        LuaJitStats jit = {};
+    };
+
+    // Monotonic clock for timing calls
+    static uint64_t getNanoseconds();
+
+    // Audio thread
+    void reset();
+    void recordCall(uint64_t ns);
+    void recordGarbage(float us, int memoryKB, int peakKB);
+    void recordJit(const LuaJitStats &stats);
+
+    // UI thread, call `updateRate()` regularly with the time in seconds to measure calls per second
+    void updateRate(double now);
+    Stats snapshot();
+
+  private:
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint32_t> history[HISTORY] = {};
+    std::atomic<float> gcTime{0.f};
+    std::atomic<int> gcMemory{0};
+    std::atomic<int> memoryPeak{0};
+    std::atomic<int> jitEnabled{0};
+    std::atomic<int> jitTraces{0};
+    std::atomic<int> jitAborts{0};
+    std::atomic<int> jitFlushes{0};
+
+    // Only touched by the UI thread
+    uint64_t lastCalls = 0;
+    double lastTime = 0.0;
+    double lastRate = 0.0;
+};
@@ -0,0 +1,82 @@
+// LuaQueue.hpp
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+// Bounded lock-free MPMC queue, safe to use on the audio thread: no locks and no allocation after construction
+// Each cell's sequence number tells producers and consumers whose turn it is
+template <typename T, size_t N> struct LuaQueue
+{
+    LuaQueue()
+    {
+        for (size_t i = 0; i < N; i++)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    // Returns false when the queue is full
+    bool push(const T &value)
+    {
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Cell &cell = cells[pos % N];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+            if (diff == 0)
+            {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    cell.value = value;
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+                return false;
+            else
+                pos = enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    // Returns false when the queue is empty
+    bool pop(T &value)
+    {
+        size_t pos = dequeuePos.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Cell &cell = cells[pos % N];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+            if (diff == 0)
+            {
+                if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    value = std::move(cell.value);
+                    cell.sequence.store(pos + N, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+                return false;
+            else
+                pos = dequeuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    // Only a hint while other threads push or pop
+    bool empty() const { return dequeuePos.load(std::memory_order_acquire) == enqueuePos.load(std::memory_order_acquire); }
+
+  private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+    Cell cells[N];
+    alignas(64) std::atomic<size_t> enqueuePos{0};
+    alignas(64) std::atomic<size_t> dequeuePos{0};
+};
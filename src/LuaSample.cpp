@@ -0,0 +1,88 @@
+// LuaSample.cpp
+
+#include "LuaSample.hpp"
+#include "LuaScript.hpp"
+#include "WavFile.hpp"
+#include <cstring>
+
+constexpr int LuaSampleBank::MAX_SAMPLES;
+constexpr int LuaSampleBank::MAX_PATH_LENGTH;
+
+void initSampleApi(LuaSampleApi &api, LuaSampleBank *bank)
+{
+    api.load = LuaSampleBank::lua_load;
+    api.bank = bank;
+}
+
+// Script thread: takes a slot and queues it, without locking or allocating
+// Returns nullptr when all slots are used or the path doesn't fit, the path itself is checked in `sample.lua`
+LuaSample *LuaSampleBank::lua_load(LuaSampleApi *api, const char *path)
+{
+    LuaSampleBank *bank = api->bank;
+    size_t length = std::strlen(path);
+    if (bank->count >= MAX_SAMPLES || length >= MAX_PATH_LENGTH)
+        return nullptr;
+
+    int index = bank->count++;
+    Slot &slot = bank->slots[index];
+    std::memcpy(slot.path, path, length + 1);
+    slot.sample.status = LUA_SAMPLE_LOADING;
+
+    if (!bank->requests)
+        bank->decode(index);
+    else if (!bank->requests->push(LuaSampleRequest{bank->shared_from_this(), index}))
+    {
+        LuaScript::log(2, "Lua sample error: Too many samples loading at once");
+        slot.sample.status = LUA_SAMPLE_FAILED;
+    }
+    return &slot.sample;
+}
+
+void LuaSampleBank::decode(int index)
+{
+    Slot &slot = slots[index];
+    std::string path = dir + "/" + slot.path;
+
+    WavFile wav;
+    std::string error = "Samples can only be loaded by scripts saved to a file";
+    slot.ok = !dir.empty() && wav.read(path, error);
+    if (slot.ok)
+    {
+        // Planar with every channel 16 byte aligned, so a channel can be read as one contiguous table
+        int length = (int)wav.getFrames();
+        slot.length = length;
+        slot.channels = wav.channels;
+        slot.stride = (length + 3) & ~3;
+        slot.samplerate = (float)wav.sampleRate;
+        slot.data.assign((size_t)slot.stride * wav.channels, 0.f);
+        for (int c = 0; c < wav.channels; c++)
+        {
+            float *dst = slot.data.data() + (size_t)c * slot.stride;
+            for (int n = 0; n < length; n++)
+                dst[n] = wav.samples[(size_t)n * wav.channels + c];
+        }
+    }
+    else
+        LuaScript::log(2, ("Lua sample error: " + error).c_str());
+
+    loaded.push(index);
+}
+
+void LuaSampleBank::publishLoaded()
+{
+    int index;
+    while (loaded.pop(index))
+    {
+        Slot &slot = slots[index];
+        LuaSample &sample = slot.sample;
+        if (slot.ok)
+        {
+            sample.data = slot.data.data();
+            sample.length = slot.length;
+            sample.channels = slot.channels;
+            sample.stride = slot.stride;
+            sample.samplerate = slot.samplerate;
+        }
+        sample.status = slot.ok ? LUA_SAMPLE_READY : LUA_SAMPLE_FAILED;
+    }
+}
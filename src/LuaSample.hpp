@@ -0,0 +1,99 @@
+// LuaSample.hpp
+
+#pragma once
+
+#include "LuaQueue.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+
+// WAV samples and wavetables for scripts, called from `res/lua/sample.lua` through FFI
+// Files are decoded on a worker thread into buffers outside the Lua heap, scripts see them once they are ready
+extern "C" {
+
+enum LuaSampleStatus
+{
+    LUA_SAMPLE_LOADING,
+    LUA_SAMPLE_READY,
+    LUA_SAMPLE_FAILED
+};
+
+// Opaque to scripts, `sample.lua` reads it through the private LuaSampleData cdef, which must match this layout
+// Only written on the thread running the script
+// Channels are stored one after another, each starting on a 16 byte boundary `stride` floats apart
+struct LuaSample
+{
+    const float *data;
+    int length;
+    int channels;
+    int stride;
+    float samplerate;
+    int status;
+};
+
+// Only the first field is declared in `sample.lua`
+struct LuaSampleApi
+{
+    LuaSample *(*load)(LuaSampleApi *api, const char *path);
+    struct LuaSampleBank *bank;
+};
+
+} // extern "C"
+
+struct LuaSampleBank;
+
+// A sample for the host to decode, holding the bank keeps it alive when the script is gone before the job runs
+struct LuaSampleRequest
+{
+    std::shared_ptr<LuaSampleBank> bank;
+    int slot;
+};
+
+typedef LuaQueue<LuaSampleRequest, 64> LuaSampleQueue;
+
+// The samples of one script, the script only allocates slots and publishes finished loads
+struct LuaSampleBank : std::enable_shared_from_this<LuaSampleBank>
+{
+    static constexpr int MAX_SAMPLES = 64;
+    static constexpr int MAX_PATH_LENGTH = 512;
+
+    // Paths are relative to this folder
+    std::string dir;
+
+    // Requests go here when set, otherwise files are decoded right away by the caller
+    LuaSampleQueue *requests = nullptr;
+
+    // Worker thread: reads and deinterleaves a requested file
+    void decode(int slot);
+
+    // Script thread: hands finished loads over to Lua
+    void publish()
+    {
+        if (!loaded.empty())
+            publishLoaded();
+    }
+
+  private:
+    struct Slot
+    {
+        LuaSample sample = {};
+        char path[MAX_PATH_LENGTH];
+        std::vector<float> data;
+        int length = 0;
+        int channels = 0;
+        int stride = 0;
+        float samplerate = 0.f;
+        bool ok = false;
+    };
+
+    Slot slots[MAX_SAMPLES];
+    int count = 0;
+    LuaQueue<int, MAX_SAMPLES> loaded;
+
+    void publishLoaded();
+    static LuaSample *lua_load(LuaSampleApi *api, const char *path);
+    friend void initSampleApi(LuaSampleApi &api, LuaSampleBank *bank);
+};
+
+// Fills the function table for a script's bank
+void initSampleApi(LuaSampleApi &api, LuaSampleBank *bank);
@@ -0,0 +1,636 @@
+// LuaScript.cpp
+
+#include "LuaScript.hpp"
+#include "LuaPreludes.hpp"
+#include "LuaWatchdog.hpp"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <initializer_list>
+#include <iterator>
+
+void (*LuaScript::logHandler)(int level, const char *message) = nullptr;
+
+// Top-level code may build large tables, so loading gets a longer deadline than a call
+static const int LOAD_DEADLINE_MS = 2000;
+
+// Registry key of the script owning a state, for the deadline hook
+static const char scriptKey = 0;
+
+LuaScript::LuaScript() { resetBlock(44100.f, 64); }
+
+LuaScript::~LuaScript()
+{
+    if (watched)
+        LuaWatchdog::instance().remove(this);
+    if (L)
+        lua_close(L);
+    delete arena;
+}
+
+void LuaScript::log(int level, const char *message)
+{
+    if (logHandler)
+        logHandler(level, message);
+    else
+        std::fprintf(stderr, "%s\n", message);
+}
+
+bool LuaScript::fail(const std::string &message)
+{
+    errorMessage = message;
+    return false;
+}
+
+// Sets the error message after a failed protected call and pops the error
+bool LuaScript::failCall(int status, const std::string &prefix)
+{
+    if (status == LUA_ERRMEM && arena && arena->isExhausted())
+        fail(prefix + "Memory limit of " + std::to_string(arena->getCapacity() >> 20) + " MB exceeded");
+    else
+        fail(prefix + lua_tostring(L, -1));
+    lua_pop(L, 1); // Pop error
+    return false;
+}
+
+// The script owning a state, stored in the registry when the state is created
+LuaScript *LuaScript::getScript(lua_State *L)
+{
+    lua_pushlightuserdata(L, (void *)&scriptKey);
+    lua_rawget(L, LUA_REGISTRYINDEX);
+    LuaScript *script = static_cast<LuaScript *>(lua_touserdata(L, -1));
+    lua_pop(L, 1);
+    return script;
+}
+
+// `print()` and `log.debug/info/warn()`, the level is the closure's upvalue
+// Arguments are joined with tabs into one line in a fixed buffer, so logging from `process()` doesn't allocate
+int LuaScript::lua_sandboxLog(lua_State *L)
+{
+    LuaLogMessage message;
+    message.level = (int)lua_tointeger(L, lua_upvalueindex(1));
+    message.length = 0;
+
+    int n = lua_gettop(L);
+    for (int i = 1; i <= n; i++)
+    {
+        const char *text;
+        size_t length;
+        if (lua_isstring(L, i))
+            text = lua_tolstring(L, i, &length);
+        else
+        {
+            text = lua_isboolean(L, i) ? (lua_toboolean(L, i) ? "true" : "false") : lua_typename(L, lua_type(L, i));
+            length = std::strlen(text);
+        }
+
+        if (i > 1 && message.length < LuaLogMessage::MAX_LENGTH - 1)
+            message.text[message.length++] = '\t';
+        length = std::min(length, (size_t)(LuaLogMessage::MAX_LENGTH - 1 - message.length));
+        std::memcpy(message.text + message.length, text, length);
+        message.length += (int)length;
+    }
+    message.text[message.length] = '\0';
+
+    LuaScript *script = getScript(L);
+    if (script && script->logBuffer)
+        script->logBuffer->push(message);
+    else
+        log(message.level, message.text);
+    return 0;
+}
+
+// Error handler that appends a stack traceback to Lua errors
+int LuaScript::lua_traceback(lua_State *L)
+{
+    const char *message = lua_tostring(L, 1);
+    luaL_traceback(L, L, message ? message : "(error object is not a string)", 1);
+    return 1;
+}
+
+// Runs `process()` once for each buffered frame, all inside a single protected call
+int LuaScript::lua_processFrames(lua_State *L)
+{
+    LuaScript *script = static_cast<LuaScript *>(lua_touserdata(L, 1));
+    int frames = (int)lua_tointeger(L, 2);
+    LuaProcessBlock &b = script->block;
+    int64_t frame = b.frame;
+
+    for (int n = 0; n < frames; n++)
+    {
+        b.frame = frame + n;
+        for (int i = 0; i < NUM_ROWS; i++)
+        {
+            b.input[i] = b.inputs[i][n];
+            b.knob[i] = b.knobs[i][n];
+            b.button[i] = b.buttons[i][n];
+        }
+        std::memcpy(b.polyinput, b.polyinputs[n], sizeof(b.polyinput));
+        b.busin = b.businputs[n];
+        b.busout = b.busoutputs[n];
+
+        if (script->controlRef != LUA_NOREF && --script->controlCountdown <= 0)
+        {
+            script->controlCountdown = script->controlInterval;
+            lua_rawgeti(L, LUA_REGISTRYINDEX, script->controlRef);
+            lua_call(L, 0, 0);
+        }
+
+        lua_rawgeti(L, LUA_REGISTRYINDEX, script->processRef);
+        lua_call(L, 0, 0);
+
+        for (int i = 0; i < NUM_ROWS; i++)
+            b.outputs[i][n] = b.output[i];
+        std::memcpy(b.polyoutputs[n], b.polyoutput, sizeof(b.polyoutput));
+    }
+    return 0;
+}
+
+void LuaScript::resetBlock(float sampleRate, int blockSize)
+{
+    block.frame = 0;
+    block.samplerate = sampleRate;
+    block.sampletime = 1.f / sampleRate;
+    block.channels = NUM_ROWS;
+    block.blocksize = blockSize;
+
+    for (int i = 0; i < NUM_ROWS; i++)
+    {
+        block.input[i] = 0.f;
+        block.knob[i] = 0.f;
+        block.button[i] = false;
+        block.output[i] = 0.f;
+
+        for (int c = 0; c < NUM_COLOR; c++)
+            block.light[i][c] = 0.f;
+
+        block.inchannels[i] = 0;
+        block.outchannels[i] = 0;
+        for (int c = 0; c < NUM_CHANNELS; c++)
+        {
+            block.polyinput[i][c] = 0.f;
+            block.polyoutput[i][c] = 0.f;
+        }
+
+        // Block buffers start empty, so the first block outputs silence
+        for (int n = 0; n < MAX_BLOCK_SIZE; n++)
+        {
+            block.inputs[i][n] = 0.f;
+            block.knobs[i][n] = 0.f;
+            block.buttons[i][n] = false;
+            block.outputs[i][n] = 0.f;
+        }
+    }
+
+    block.busin = block.businputs[0];
+    block.busout = block.busoutputs[0];
+    block.businchannels = 0;
+    block.busoutchannels = 0;
+    std::memset(block.businputs, 0, sizeof(block.businputs));
+    std::memset(block.busoutputs, 0, sizeof(block.busoutputs));
+    std::memset(block.polyinputs, 0, sizeof(block.polyinputs));
+    std::memset(block.polyoutputs, 0, sizeof(block.polyoutputs));
+}
+
+bool LuaScript::createLuaState(const std::string &libDir)
+{
+    // Builds that cannot take a custom allocator (64-bit without GC64) fall back to the system one
+    arena = new LuaArena(memoryLimit);
+    if (arena->getCapacity() > 0)
+        L = lua_newstate(LuaArena::alloc, arena);
+    if (!L)
+    {
+        log(2, "Lua state uses the system allocator, the memory limit is not enforced");
+        delete arena;
+        arena = nullptr;
+        L = luaL_newstate();
+    }
+    if (!L)
+        return fail("Lua error: Failed to initialize Lua state");
+
+    lua_pushlightuserdata(L, (void *)&scriptKey);
+    lua_pushlightuserdata(L, this);
+    lua_rawset(L, LUA_REGISTRYINDEX);
+
+    // Push and call each library loader for the required libraries in the global environment
+    // clang-format off
+        const std::initializer_list<luaL_Reg> lib_load = {
+            {"", luaopen_base},
+            {LUA_LOADLIBNAME, luaopen_package},
+            {LUA_TABLIBNAME, luaopen_table},
+            {LUA_STRLIBNAME, luaopen_string},
+            {LUA_MATHLIBNAME, luaopen_math},
+            {LUA_BITLIBNAME, luaopen_bit},
+            {LUA_JITLIBNAME, luaopen_jit},
+            {LUA_OSLIBNAME, luaopen_os},
+            {LUA_FFILIBNAME, luaopen_ffi}
+        };
+    // clang-format on
+    for (const auto &lib : lib_load)
+    {
+        lua_pushcfunction(L, lib.func);
+        lua_pushstring(L, lib.name);
+        lua_call(L, 1, 0);
+    }
+
+    // Create empty sandbox table
+    lua_newtable(L);
+
+    // Add custom functions to the sandbox environment
+    lua_pushinteger(L, 0);
+    lua_pushcclosure(L, lua_sandboxLog, 1);
+    lua_setfield(L, -2, "print");
+
+    // Levelled logging, `log.warn()` lines also show as warnings in Rack's log
+    lua_newtable(L);
+    static constexpr std::array<const char *, 3> logLevels = {"debug", "info", "warn"};
+    for (int level = 0; level < (int)logLevels.size(); level++)
+    {
+        lua_pushinteger(L, level);
+        lua_pushcclosure(L, lua_sandboxLog, 1);
+        lua_setfield(L, -2, logLevels[level]);
+    }
+    lua_setfield(L, -2, "log");
+
+    // Save `time()` before disabling `os` so that it can be used for `math.randomseed()`
+    lua_getglobal(L, "os");
+    lua_getfield(L, -1, "time");
+    lua_setfield(L, -3, "time");
+    lua_pop(L, 1); // Pop os
+
+    // Add allowed standard library tables to the sandbox
+    static constexpr std::array<const char *, 4> allowedLibs = {"math", "string", "table", "bit"};
+    for (const auto &table : allowedLibs)
+    {
+        lua_getglobal(L, table);
+        if (!lua_istable(L, -1))
+        {
+            lua_pop(L, 1); // Pop nil
+            log(2, (std::string("Lua error: Not a function table: ") + table).c_str());
+            continue;
+        }
+        lua_setfield(L, -2, table);
+    }
+
+    // Add allowed functions to the sandbox
+    static constexpr std::array<const char *, 12> allowedFuncs = {"pairs",    "ipairs",       "unpack", "next",  "type",   "tostring",
+                                                                  "tonumber", "setmetatable", "assert", "pcall", "xpcall", "error"};
+    for (const auto &func : allowedFuncs)
+    {
+        lua_getglobal(L, func);
+        if (lua_isnil(L, -1))
+        {
+            lua_pop(L, 1); // Pop nil
+            log(2, (std::string("Lua function not found: ") + func).c_str());
+            continue;
+        }
+        lua_setfield(L, -2, func);
+    }
+
+    // Load and run the utility library
+    if (runPrelude(libDir, "util.lua"))
+        return fail(std::string("Lua error loading utility library:\n") + lua_tostring(L, -1));
+
+    // Store the sandbox table globally as _SANDBOX for later use
+    lua_pushvalue(L, -1);
+    lua_setglobal(L, "_SANDBOX");
+
+    // Load and run the FFI file
+    if (runPrelude(libDir, "ffi.lua"))
+        return fail(std::string("Lua error loading FFI script:\n") + lua_tostring(L, -1));
+
+    // Native libraries allocate from this state, so their memory counts against the script's limit
+    // Their objects are also counted towards the GC threshold
+    stateAlloc = lua_getallocf(L, &stateAllocData);
+    initDspApi(dspApi, nativeAlloc, this, &block);
+    initArrayApi(arrayApi, nativeAlloc, this, &block);
+    if (!loadNativeLibrary(libDir, "dsp.lua", "_createDsp", &dspApi, "dsp"))
+        return false;
+    if (!loadNativeLibrary(libDir, "array.lua", "_createArray", &arrayApi, "array"))
+        return false;
+
+    // Sample data lives outside the arena, the bank only hands Lua read-only views
+    samples->dir = sampleDir;
+    samples->requests = sampleRequests;
+    initSampleApi(sampleApi, samples.get());
+    if (!loadNativeLibrary(libDir, "sample.lua", "_createSample", &sampleApi, "sample"))
+        return false;
+
+    // Disable unsafe functions and modules in the global environment for added safety
+    // clang-format off
+        const std::initializer_list<const char *> unsafeFuncs = {
+            "collectgarbage", "dofile", "getfenv", "getmetatable", "load", "loadfile", "loadstring", "module",
+            "rawequal", "rawget", "rawset", "require", "setfenv", "ffi", "io", "os", "package", "debug", "_G"
+        };
+    // clang-format on
+    lua_getglobal(L, "_G");
+    for (const auto &func : unsafeFuncs)
+    {
+        lua_pushnil(L);
+        lua_setfield(L, -2, func);
+    }
+    lua_pop(L, 2); // Pop _G (or nil) and sandbox table
+
+    return true;
+}
+
+// Runs a prelude from its embedded bytecode, or from `libDir` when it was not embedded or was built for another LuaJIT
+// Returns 0 on success like `luaL_dofile()`, otherwise the error message is on the stack
+int LuaScript::runPrelude(const std::string &libDir, const char *file)
+{
+    if (const LuaPrelude *prelude = findPrelude(file))
+    {
+        if (!luaL_loadbufferx(L, (const char *)prelude->bytecode, prelude->size, file, "b"))
+            return lua_pcall(L, 0, LUA_MULTRET, 0);
+        lua_pop(L, 1); // Pop error
+    }
+    std::string path = libDir + "/" + file;
+    return luaL_dofile(L, path.c_str());
+}
+
+// Runs the prelude `file` and adds the table its constructor builds from `api` to the sandbox on top of the stack
+bool LuaScript::loadNativeLibrary(const std::string &libDir, const char *file, const char *constructor, void *api, const char *name)
+{
+    if (runPrelude(libDir, file))
+        return fail(std::string("Lua error loading ") + name + " library:\n" + lua_tostring(L, -1));
+
+    lua_getglobal(L, constructor);
+    lua_pushlightuserdata(L, api);
+    if (lua_pcall(L, 1, 1, 0))
+        return fail(std::string("Lua error creating ") + name + " library:\n" + lua_tostring(L, -1));
+    lua_setfield(L, -2, name);
+    return true;
+}
+
+// FNV-1a over everything that changes the bytecode, so edits and LuaJIT upgrades miss the cache
+static std::string cacheKey(const std::string &source, const std::string &chunkName)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    auto mix = [&](const std::string &s) {
+        for (unsigned char c : s)
+            hash = (hash ^ c) * 0x100000001b3ULL;
+        hash = (hash ^ 0xff) * 0x100000001b3ULL;
+    };
+    mix(LUAJIT_VERSION);
+    mix(std::to_string(sizeof(void *)));
+    mix(chunkName);
+    mix(source);
+
+    char key[17];
+    std::snprintf(key, sizeof(key), "%016llx", (unsigned long long)hash);
+    return key;
+}
+
+static int writeBytecode(lua_State *L, const void *p, size_t size, void *ud)
+{
+    static_cast<std::string *>(ud)->append(static_cast<const char *>(p), size);
+    return 0;
+}
+
+// Pushes the compiled script, from the bytecode cache when possible, returns a `luaL_loadbuffer()` status
+// Script source is always loaded as text, so a script cannot smuggle in bytecode that escapes the sandbox
+// The cache directory is trusted local data written only by LuaBox
+int LuaScript::loadScriptChunk(const std::string &source, const std::string &chunkName)
+{
+    loadedFromCache = false;
+    if (cacheDir.empty())
+        return luaL_loadbufferx(L, source.c_str(), source.size(), chunkName.c_str(), "t");
+
+    std::string path = cacheDir + "/" + cacheKey(source, chunkName) + ".ljbc";
+    std::ifstream cached(path, std::ios::binary);
+    if (cached)
+    {
+        std::string bytecode((std::istreambuf_iterator<char>(cached)), std::istreambuf_iterator<char>());
+        if (!luaL_loadbufferx(L, bytecode.data(), bytecode.size(), chunkName.c_str(), "b"))
+        {
+            loadedFromCache = true;
+            return 0;
+        }
+        lua_pop(L, 1); // Pop error, the entry is rewritten below
+    }
+
+    int status = luaL_loadbufferx(L, source.c_str(), source.size(), chunkName.c_str(), "t");
+    if (status)
+        return status;
+
+    // Write to a temporary file first, modules loading the same script may race for the same entry
+    std::string bytecode;
+    if (!lua_dump(L, writeBytecode, &bytecode))
+    {
+        std::string tempPath = path + "." + std::to_string((uintptr_t)this) + ".tmp";
+        std::ofstream file(tempPath, std::ios::binary);
+        bool written = (bool)file.write(bytecode.data(), bytecode.size());
+        file.close();
+        if (!written || std::rename(tempPath.c_str(), path.c_str()))
+            std::remove(tempPath.c_str());
+    }
+    return 0;
+}
+
+// Called by the watchdog thread, lua_sethook() is the one Lua API function that is safe to call asynchronously
+void LuaScript::interrupt(uint32_t sequence)
+{
+    interruptSequence.store(sequence, std::memory_order_release);
+    lua_sethook(L, lua_deadlineHook, LUA_MASKCOUNT, 1);
+}
+
+// Runs on the script's thread, raising errors until the late call has unwound, so `pcall()` in the script can't hold on
+// A hook left over from a call that finished in time removes itself
+void LuaScript::lua_deadlineHook(lua_State *L, lua_Debug *ar)
+{
+    LuaScript *script = getScript(L);
+    if (!script || script->callSequence.load(std::memory_order_relaxed) != script->interruptSequence.load(std::memory_order_acquire))
+    {
+        lua_sethook(L, nullptr, 0, 0);
+        return;
+    }
+    script->deadlineMissed = true;
+    luaL_error(L, "Deadline of %d ms exceeded", script->activeDeadline.load(std::memory_order_relaxed));
+}
+
+bool LuaScript::load(const std::string &source, const std::string &chunkName, const std::string &libDir)
+{
+    if (!createLuaState(libDir))
+        return false;
+
+    if (deadline > 0)
+    {
+        activeDeadline = std::max(deadline, LOAD_DEADLINE_MS);
+        LuaWatchdog::instance().add(this);
+        watched = true;
+    }
+
+    // Pin the traceback handler at stack index 1 for every protected call
+    lua_pushcfunction(L, lua_traceback);
+
+    // Retrieve the sandbox environment table and get its index
+    lua_getglobal(L, "_SANDBOX");
+    int sandbox_idx = lua_gettop(L);
+
+    // Create the Lua block object by casting the C struct into Lua cdata
+    lua_getglobal(L, "_castBlock");
+    lua_pushlightuserdata(L, (void *)&block);
+    if (lua_pcall(L, 1, 1, 0))
+        return fail(std::string("Lua error: Could not cast block:\n") + lua_tostring(L, -1));
+    lua_setfield(L, sandbox_idx, "block"); // sandbox.block = block_cdata
+
+    // Count JIT trace events for the profiler
+    lua_getglobal(L, "_attachJitStats");
+    lua_pushlightuserdata(L, (void *)&jitStats);
+    if (lua_pcall(L, 1, 0, 0))
+        return fail(std::string("Lua error: Could not attach JIT stats:\n") + lua_tostring(L, -1));
+
+    // Load script from string
+    if (loadScriptChunk(source, chunkName))
+        return fail(std::string("Lua script error:\n") + lua_tostring(L, -1));
+
+    // Set the sandbox environment table for the loaded Lua script
+    lua_pushvalue(L, sandbox_idx);
+    if (!lua_setfenv(L, -2))
+        return fail("Lua error:\nFailed to set function environment");
+
+    // Execute script
+    beginCall();
+    int status = lua_pcall(L, 0, 0, 1);
+    endCall();
+    if (status)
+        return failCall(status, "Lua script error:\n");
+    activeDeadline = deadline;
+
+    // Prefer the block process function if the script defines one
+    lua_getfield(L, sandbox_idx, "process_block");
+    blockMode = lua_isfunction(L, -1);
+    if (!blockMode)
+    {
+        lua_pop(L, 1); // Pop nil
+        lua_getfield(L, sandbox_idx, "process");
+    }
+
+    // Get and validate process function
+    if (!lua_isfunction(L, -1))
+        return fail("Lua script error:\nRequired `process()` or `process_block()` function not found");
+
+    // Keep the process function in the registry so each call is a single lookup
+    processRef = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    // `control()` is optional, it handles knobs and lights at a lower rate than `process()`
+    lua_getfield(L, sandbox_idx, "control");
+    if (lua_isfunction(L, -1))
+        controlRef = luaL_ref(L, LUA_REGISTRYINDEX);
+    else
+        lua_pop(L, 1);
+    controlInterval = std::max(controlInterval, 1);
+    lua_pop(L, 1); // Pop sandbox
+
+    // The frame trampoline is also kept in the registry to avoid creating a closure per block
+    lua_pushcfunction(L, lua_processFrames);
+    trampolineRef = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    // Collect the garbage from loading while still off the audio thread, then leave collection to the host
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    lua_gc(L, LUA_GCSTOP, 0);
+    gcThreshold = std::max(memoryUsage() * 2, 64);
+
+    return true;
+}
+
+// Calls `control()` once `frames` more frames have used up the interval
+bool LuaScript::runControl(int frames)
+{
+    controlCountdown -= frames;
+    if (controlCountdown > 0)
+        return true;
+    controlCountdown = controlInterval;
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, controlRef);
+    beginCall();
+    int status = lua_pcall(L, 0, 0, 1);
+    endCall();
+    if (status)
+        return failCall(status, "Lua runtime error in `control()` function:\n");
+    return true;
+}
+
+bool LuaScript::run()
+{
+    samples->publish();
+    if (controlRef != LUA_NOREF && !runControl(1))
+        return false;
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, processRef);
+    beginCall();
+    int status = lua_pcall(L, 0, 0, 1);
+    endCall();
+    if (status)
+        return failCall(status, "Lua runtime error in `process()` function:\n");
+    return true;
+}
+
+bool LuaScript::runBlock(int frames)
+{
+    samples->publish();
+
+    // Without `process_block()` the trampoline runs `process()` per frame
+    if (blockMode)
+    {
+        if (controlRef != LUA_NOREF && !runControl(frames))
+            return false;
+        lua_rawgeti(L, LUA_REGISTRYINDEX, processRef);
+        lua_pushinteger(L, frames);
+    }
+    else
+    {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, trampolineRef);
+        lua_pushlightuserdata(L, this);
+        lua_pushinteger(L, frames);
+    }
+
+    beginCall();
+    int status = lua_pcall(L, blockMode ? 1 : 2, 0, 1);
+    endCall();
+    if (status)
+        return failCall(status, std::string("Lua runtime error in `") + (blockMode ? "process_block()" : "process()") + "` function:\n");
+    return true;
+}
+
+double LuaScript::collectGarbage(double budget)
+{
+    if (!gcCycle && memoryUsage() < gcThreshold)
+        return 0.0;
+    gcCycle = true;
+
+    using clock = std::chrono::steady_clock;
+    clock::time_point start = clock::now();
+    double elapsed = 0.0;
+    do
+    {
+        // Returns 1 when a cycle has finished
+        if (lua_gc(L, LUA_GCSTEP, 0))
+        {
+            gcCycle = false;
+            gcThreshold = std::max(memoryUsage() * 2, 64);
+            break;
+        }
+        elapsed = std::chrono::duration<double>(clock::now() - start).count();
+    } while (elapsed < budget);
+
+    // Stepping re-arms the allocation threshold, so stop the collector again
+    lua_gc(L, LUA_GCSTOP, 0);
+    return std::chrono::duration<double>(clock::now() - start).count();
+}
+
+int LuaScript::memoryUsage() { return lua_gc(L, LUA_GCCOUNT, 0) + (int)(nativeMemory >> 10); }
+
+// Forwards to the state's allocator and keeps `nativeMemory` up to date
+// Without it a script creating objects in a loop would fill the arena without the heap ever reaching the threshold
+void *LuaScript::nativeAlloc(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+    LuaScript *script = static_cast<LuaScript *>(ud);
+    void *block = script->stateAlloc(script->stateAllocData, ptr, osize, nsize);
+    if (block || nsize == 0)
+        script->nativeMemory = script->nativeMemory + nsize - (ptr ? osize : 0);
+    return block;
+}
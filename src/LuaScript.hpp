@@ -0,0 +1,187 @@
+// LuaScript.hpp
+
+#pragma once
+
+#include "lua.hpp"
+#include "LuaArena.hpp"
+#include "LuaArray.hpp"
+#include "LuaDsp.hpp"
+#include "LuaLog.hpp"
+#include "LuaProfiler.hpp"
+#include "LuaSample.hpp"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#define NUM_ROWS 8
+#define NUM_COLOR 3
+#define NUM_CHANNELS 16
+#define MAX_BLOCK_SIZE 256
+#define NUM_BUS_CHANNELS 32
+
+// Shared with Lua through FFI, the layout must match `res/lua/ffi.lua`
+struct LuaProcessBlock
+{
+    int64_t frame;
+    float samplerate;
+    float sampletime;
+    int channels;
+    float input[NUM_ROWS];
+    float knob[NUM_ROWS];
+    float light[NUM_ROWS][NUM_COLOR];
+    bool button[NUM_ROWS];
+    float output[NUM_ROWS];
+    int blocksize;
+    float inputs[NUM_ROWS][MAX_BLOCK_SIZE];
+    float knobs[NUM_ROWS][MAX_BLOCK_SIZE];
+    bool buttons[NUM_ROWS][MAX_BLOCK_SIZE];
+    float outputs[NUM_ROWS][MAX_BLOCK_SIZE];
+    int inchannels[NUM_ROWS];
+    int outchannels[NUM_ROWS];
+    float polyinput[NUM_ROWS][NUM_CHANNELS];
+    float polyoutput[NUM_ROWS][NUM_CHANNELS];
+    // Polyphonic channels of every frame in a block, `process()` sees them through `polyinput` and `polyoutput`
+    float polyinputs[MAX_BLOCK_SIZE][NUM_ROWS][NUM_CHANNELS];
+    float polyoutputs[MAX_BLOCK_SIZE][NUM_ROWS][NUM_CHANNELS];
+    // Expander bus from the LuaBox on the left and to the one on the right, one channel vector per frame
+    // `busin` and `busout` point at the current frame, the expander messages themselves for `process()`
+    // Scripts only reach them through the opaque bus views in `ffi.lua`, never as pointers
+    float *busin;
+    float *busout;
+    int businchannels;
+    int busoutchannels;
+    float businputs[MAX_BLOCK_SIZE][NUM_BUS_CHANNELS];
+    float busoutputs[MAX_BLOCK_SIZE][NUM_BUS_CHANNELS];
+};
+
+// A sandboxed Lua state running one script, independent of Rack
+// Loading may block and allocate, so it is done off the audio thread before the script goes live
+struct LuaScript
+{
+    lua_State *L = nullptr;
+    LuaProcessBlock block;
+
+    // All memory of the state comes from the arena, sized by `memoryLimit` when loading
+    LuaArena *arena = nullptr;
+    size_t memoryLimit = 32 << 20;
+
+    // Compiled scripts are cached here as bytecode keyed by a hash of the source, empty disables the cache
+    std::string cacheDir;
+    bool loadedFromCache = false;
+
+    // Trace event counters, updated by Lua from the `jit.attach()` handler
+    LuaJitStats jitStats = {};
+
+    // Functions behind the `dsp` and `array` tables, allocating from this state
+    LuaDspApi dspApi = {};
+    LuaArrayApi arrayApi = {};
+
+    // Samples loaded through `sample.load()`, paths are relative to `sampleDir`
+    // The host sets `sampleRequests` to decode them on a worker, otherwise they are read when requested
+    std::shared_ptr<LuaSampleBank> samples = std::make_shared<LuaSampleBank>();
+    LuaSampleApi sampleApi = {};
+    std::string sampleDir;
+    LuaSampleQueue *sampleRequests = nullptr;
+
+    // Registry references to the process function and the frame trampoline
+    int processRef = LUA_NOREF;
+    int trampolineRef = LUA_NOREF;
+
+    // Optional `control()` function, called every `controlInterval` frames before processing
+    // Block mode calls it at most once per block
+    int controlRef = LUA_NOREF;
+    int controlInterval = 1;
+    int controlCountdown = 0;
+
+    // Block mode is used when the script defines `process_block(n)`
+    bool blockMode = false;
+
+    // Position of the current frame within the block, kept by the host
+    int blockIndex = 0;
+
+    // Frames since the last GC step, kept by the host for `process()` scripts
+    int gcFrames = 0;
+
+    // Calls running longer than this many ms are interrupted with an error by LuaWatchdog, 0 disables it
+    // Set before `load()`, loading itself gets at least LOAD_DEADLINE_MS
+    int deadline = 0;
+
+    // Set when the last error came from a missed deadline
+    bool deadlineMissed = false;
+
+    // Script frames per engine frame, the block's sample rate and frame counter are at the oversampled rate
+    int oversample = 1;
+
+    std::string errorMessage = "";
+
+    // Lines from `print()` and `log.*()` go here when the host sets it, otherwise to `logHandler`
+    LuaLogBuffer *logBuffer = nullptr;
+
+    // Log output for host warnings, levels follow Rack's logger (0 debug, 1 info, 2 warn)
+    static void (*logHandler)(int level, const char *message);
+    static void log(int level, const char *message);
+
+    LuaScript();
+    ~LuaScript();
+
+    // Clears the block and sets the engine values, call before `load()`
+    void resetBlock(float sampleRate, int blockSize);
+
+    // Creates the state, runs the preludes from `libDir` and then the script's top-level code
+    bool load(const std::string &source, const std::string &chunkName, const std::string &libDir);
+
+    // Runs `process()` for the current frame
+    bool run();
+
+    // Runs `process_block()`, or `process()` for every buffered frame, in one protected call
+    bool runBlock(int frames);
+
+    // Runs incremental GC steps until `budget` seconds have passed or a cycle finishes, returns the time spent
+    // The collector is stopped after loading, so this is the only place garbage is collected
+    double collectGarbage(double budget);
+
+    // Lua heap and native objects in KB
+    int memoryUsage();
+
+  private:
+    // Odd while a call into Lua runs, only advanced by the thread running the script
+    std::atomic<uint32_t> callSequence{0};
+    std::atomic<uint32_t> interruptSequence{0};
+    std::atomic<int> activeDeadline{0};
+    bool watched = false;
+
+    void beginCall() { callSequence.store(callSequence.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+    void endCall()
+    {
+        callSequence.store(callSequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        if (deadlineMissed)
+            lua_sethook(L, nullptr, 0, 0);
+    }
+    void interrupt(uint32_t sequence);
+    static void lua_deadlineHook(lua_State *L, lua_Debug *ar);
+    friend struct LuaWatchdog;
+
+    // A new cycle only starts once the heap has grown past this size in KB
+    int gcThreshold = 0;
+    bool gcCycle = false;
+
+    // Native objects are only freed by their finalizers, so their bytes are counted here and added to the heap size
+    // The native libraries allocate through `nativeAlloc`, which forwards to the state's allocator
+    size_t nativeMemory = 0;
+    lua_Alloc stateAlloc = nullptr;
+    void *stateAllocData = nullptr;
+    static void *nativeAlloc(void *ud, void *ptr, size_t osize, size_t nsize);
+
+    bool createLuaState(const std::string &libDir);
+    bool loadNativeLibrary(const std::string &libDir, const char *file, const char *constructor, void *api, const char *name);
+    int runPrelude(const std::string &libDir, const char *file);
+    int loadScriptChunk(const std::string &source, const std::string &chunkName);
+    bool runControl(int frames);
+    bool fail(const std::string &message);
+    bool failCall(int status, const std::string &prefix);
+    static LuaScript *getScript(lua_State *L);
+    static int lua_sandboxLog(lua_State *L);
+    static int lua_traceback(lua_State *L);
+    static int lua_processFrames(lua_State *L);
+};
@@ -0,0 +1,86 @@
+// LuaWatchdog.cpp
+
+#include "LuaWatchdog.hpp"
+#include "LuaScript.hpp"
+#include <algorithm>
+#include <chrono>
+#include <string>
+
+// Sampling period, deadlines are checked with this resolution
+static const int SAMPLE_MS = 1;
+
+// After this long past the deadline, a call that is still running is reported as stuck in native code
+static const double STUCK_TIME = 1.0;
+
+static double getTime()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+LuaWatchdog &LuaWatchdog::instance()
+{
+    static LuaWatchdog watchdog;
+    return watchdog;
+}
+
+LuaWatchdog::LuaWatchdog() { thread = std::thread(&LuaWatchdog::run, this); }
+
+LuaWatchdog::~LuaWatchdog()
+{
+    stopping = true;
+    thread.join();
+}
+
+void LuaWatchdog::add(LuaScript *script)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.push_back(Entry{script, script->callSequence.load(std::memory_order_acquire), getTime(), false});
+}
+
+void LuaWatchdog::remove(LuaScript *script)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.erase(std::remove_if(entries.begin(), entries.end(), [=](const Entry &entry) { return entry.script == script; }),
+                  entries.end());
+}
+
+// A call is over its deadline when two samples see the same odd sequence far enough apart
+// The interrupt is repeated on every sample while the call runs, in case the hook was lost
+void LuaWatchdog::run()
+{
+    while (!stopping)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(SAMPLE_MS));
+
+        double now = getTime();
+        std::lock_guard<std::mutex> lock(mutex);
+        for (Entry &entry : entries)
+        {
+            LuaScript *script = entry.script;
+            uint32_t sequence = script->callSequence.load(std::memory_order_acquire);
+            int deadline = script->activeDeadline.load(std::memory_order_relaxed);
+            if (!(sequence & 1) || sequence != entry.sequence || deadline <= 0)
+            {
+                entry.sequence = sequence;
+                entry.since = now;
+                entry.warned = false;
+                continue;
+            }
+
+            double elapsed = now - entry.since;
+            if (elapsed < deadline * 1e-3)
+                continue;
+            script->interrupt(sequence);
+
+            // LuaJIT is built with LUAJIT_ENABLE_CHECKHOOK, so compiled loops reach the hook too
+            // Only a call that doesn't return from C, like a native function called through FFI, stays stuck
+            if (!entry.warned && elapsed >= deadline * 1e-3 + STUCK_TIME)
+            {
+                entry.warned = true;
+                script->log(2, ("Lua call has been running for " + std::to_string((int)elapsed) +
+                                " s, it is stuck in native code and can't be interrupted")
+                                   .c_str());
+            }
+        }
+    }
+}
@@ -0,0 +1,43 @@
+// LuaWatchdog.hpp
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct LuaScript;
+
+// Shared thread that samples the calls of every watched script and interrupts those over their deadline
+// Scripts only advance a counter around each call, so watching costs nothing measurable when no deadline is hit
+struct LuaWatchdog
+{
+    static LuaWatchdog &instance();
+
+    void add(LuaScript *script);
+
+    // The script is not touched by the watchdog once this returns
+    void remove(LuaScript *script);
+
+    ~LuaWatchdog();
+
+  private:
+    struct Entry
+    {
+        LuaScript *script;
+        // Call seen by the last sample, and when it was first seen
+        uint32_t sequence;
+        double since;
+        bool warned;
+    };
+
+    std::mutex mutex;
+    std::vector<Entry> entries;
+    std::thread thread;
+    std::atomic<bool> stopping{false};
+
+    LuaWatchdog();
+    void run();
+};
@@ -0,0 +1,208 @@
+// LuaWatcher.cpp
+
+#include "LuaWatcher.hpp"
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <utility>
+#include <vector>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// Editors often save in several writes or through a temporary file, so wait for the file to settle
+static const double DEBOUNCE_TIME = 0.05;
+static const double POLL_TIME = 0.25;
+static const int WAIT_MS = 20;
+
+static double getTime()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool readFile(const std::string &path, std::string &contents)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+LuaWatcher &LuaWatcher::instance()
+{
+    static LuaWatcher watcher;
+    return watcher;
+}
+
+LuaWatcher::LuaWatcher()
+{
+#ifdef __linux__
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+    thread = std::thread(&LuaWatcher::run, this);
+}
+
+LuaWatcher::~LuaWatcher()
+{
+    stopping = true;
+    thread.join();
+#ifdef __linux__
+    if (inotifyFd >= 0)
+        close(inotifyFd);
+#endif
+}
+
+void LuaWatcher::watch(const void *owner, const std::string &path, Callback callback)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    removeWatch(owner);
+
+    Watch &watch = watches[owner];
+    watch.path = path;
+    watch.callback = std::move(callback);
+    size_t slash = path.find_last_of("/\\");
+    watch.name = slash == std::string::npos ? path : path.substr(slash + 1);
+
+    // Watch the directory rather than the file, saving through a rename replaces the inode
+#ifdef __linux__
+    if (inotifyFd >= 0)
+    {
+        std::string dir = slash == std::string::npos ? "." : path.substr(0, std::max<size_t>(slash, 1));
+        watch.descriptor = inotify_add_watch(inotifyFd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_MODIFY);
+    }
+#endif
+
+    // Take the current state as the baseline, so watching doesn't trigger a reload by itself
+    pollFile(watch, getTime());
+    watch.changed = -1.0;
+}
+
+void LuaWatcher::unwatch(const void *owner)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    removeWatch(owner);
+}
+
+// Directory watches are shared by every file in the same directory, only the last user removes it
+void LuaWatcher::removeWatch(const void *owner)
+{
+    auto it = watches.find(owner);
+    if (it == watches.end())
+        return;
+    int descriptor = it->second.descriptor;
+    watches.erase(it);
+
+#ifdef __linux__
+    if (descriptor < 0)
+        return;
+    for (const auto &other : watches)
+    {
+        if (other.second.descriptor == descriptor)
+            return;
+    }
+    inotify_rm_watch(inotifyFd, descriptor);
+#endif
+}
+
+// Polling only sees whole seconds on some file systems, inotify doesn't have that limit
+void LuaWatcher::pollFile(Watch &watch, double now)
+{
+    struct stat info;
+    int64_t modified = 0;
+    int64_t size = -1;
+    if (stat(watch.path.c_str(), &info) == 0)
+    {
+        modified = (int64_t)info.st_mtime;
+        size = (int64_t)info.st_size;
+    }
+    if (modified != watch.modified || size != watch.size)
+    {
+        watch.modified = modified;
+        watch.size = size;
+        if (size >= 0)
+            watch.changed = now;
+    }
+}
+
+// Blocks for a short while, marking watches whose file had events
+void LuaWatcher::waitForEvents()
+{
+#ifdef __linux__
+    if (inotifyFd >= 0)
+    {
+        struct pollfd pfd = {inotifyFd, POLLIN, 0};
+        if (poll(&pfd, 1, WAIT_MS) <= 0)
+            return;
+
+        alignas(struct inotify_event) char buffer[4096];
+        ssize_t length = read(inotifyFd, buffer, sizeof(buffer));
+        if (length <= 0)
+            return;
+
+        double now = getTime();
+        std::lock_guard<std::mutex> lock(mutex);
+        for (char *p = buffer; p < buffer + length;)
+        {
+            const struct inotify_event *event = (const struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + event->len;
+            if (event->len == 0)
+                continue;
+            for (auto &it : watches)
+            {
+                Watch &watch = it.second;
+                if (watch.descriptor == event->wd && watch.name == event->name)
+                    watch.changed = now;
+            }
+        }
+        return;
+    }
+#endif
+    std::this_thread::sleep_for(std::chrono::milliseconds(WAIT_MS));
+}
+
+void LuaWatcher::run()
+{
+    std::vector<std::pair<const void *, std::string>> settled;
+    while (!stopping)
+    {
+        waitForEvents();
+
+        double now = getTime();
+        settled.clear();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            bool poll = now - lastPoll >= POLL_TIME;
+            if (poll)
+                lastPoll = now;
+            for (auto &it : watches)
+            {
+                Watch &watch = it.second;
+                if (poll && watch.descriptor < 0)
+                    pollFile(watch, now);
+                if (watch.changed >= 0.0 && now - watch.changed >= DEBOUNCE_TIME)
+                {
+                    watch.changed = -1.0;
+                    settled.emplace_back(it.first, watch.path);
+                }
+            }
+        }
+
+        // Read outside the lock, then hand over only if the owner still watches the same file
+        for (auto &file : settled)
+        {
+            std::string source;
+            if (!readFile(file.second, source))
+                continue;
+
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = watches.find(file.first);
+            if (it != watches.end() && it->second.path == file.second)
+                it->second.callback(std::move(source));
+        }
+    }
+}
@@ -0,0 +1,54 @@
+// LuaWatcher.hpp
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Shared thread that watches script files for all LuaBox instances
+// Uses inotify on Linux and polls the modification time elsewhere, or when a directory can't be watched
+// The callback runs on the watcher thread with the new file contents once writes have settled
+struct LuaWatcher
+{
+    typedef std::function<void(std::string source)> Callback;
+
+    static LuaWatcher &instance();
+
+    // One watch per owner, watching a new path replaces the previous one
+    void watch(const void *owner, const std::string &path, Callback callback);
+
+    // The callback is not running and won't be called again once this returns
+    void unwatch(const void *owner);
+
+    ~LuaWatcher();
+
+  private:
+    struct Watch
+    {
+        std::string path;
+        std::string name;
+        Callback callback;
+        int descriptor = -1;
+        int64_t modified = 0;
+        int64_t size = -1;
+        // Time of the last change, negative once it has been handled
+        double changed = -1.0;
+    };
+
+    std::mutex mutex;
+    std::map<const void *, Watch> watches;
+    std::thread thread;
+    std::atomic<bool> stopping{false};
+    int inotifyFd = -1;
+    double lastPoll = 0.0;
+
+    LuaWatcher();
+    void run();
+    void waitForEvents();
+    void pollFile(Watch &watch, double now);
+    void removeWatch(const void *owner);
+};
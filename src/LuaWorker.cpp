@@ -0,0 +1,71 @@
+// LuaWorker.cpp
+
+#include "LuaWorker.hpp"
+#include <algorithm>
+
+void LuaJobGroup::wait()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this]() { return count == 0; });
+}
+
+LuaWorker &LuaWorker::instance()
+{
+    static LuaWorker worker;
+    return worker;
+}
+
+// Leave one core for the engine and keep the pool small, compiling is rare and short
+LuaWorker::LuaWorker()
+{
+    int numThreads = std::max(1, std::min((int)std::thread::hardware_concurrency() - 1, 4));
+    for (int i = 0; i < numThreads; i++)
+        threads.emplace_back(&LuaWorker::run, this);
+}
+
+LuaWorker::~LuaWorker()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    available.notify_all();
+    for (std::thread &thread : threads)
+        thread.join();
+}
+
+void LuaWorker::post(LuaJobGroup &group, std::function<void()> job)
+{
+    {
+        std::lock_guard<std::mutex> lock(group.mutex);
+        group.count++;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(Job{&group, std::move(job)});
+    }
+    available.notify_one();
+}
+
+void LuaWorker::run()
+{
+    while (true)
+    {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            available.wait(lock, [this]() { return stopping || !jobs.empty(); });
+            if (stopping && jobs.empty())
+                return;
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+
+        job.func();
+
+        // Notify while holding the lock, the group may be destroyed as soon as the count reaches zero
+        std::lock_guard<std::mutex> lock(job.group->mutex);
+        if (--job.group->count == 0)
+            job.group->done.notify_all();
+    }
+}
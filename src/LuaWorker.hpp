@@ -0,0 +1,47 @@
+// LuaWorker.hpp
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Counts the jobs posted by one owner, so the owner can wait for them before it is destroyed
+struct LuaJobGroup
+{
+    std::mutex mutex;
+    std::condition_variable done;
+    int count = 0;
+
+    void wait();
+};
+
+// Shared pool of worker threads that compile and destroy Lua states off the audio thread
+// Jobs may block and allocate, but must never be posted from the audio thread
+struct LuaWorker
+{
+    static LuaWorker &instance();
+
+    void post(LuaJobGroup &group, std::function<void()> job);
+
+    ~LuaWorker();
+
+  private:
+    struct Job
+    {
+        LuaJobGroup *group;
+        std::function<void()> func;
+    };
+
+    std::mutex mutex;
+    std::condition_variable available;
+    std::deque<Job> jobs;
+    std::vector<std::thread> threads;
+    bool stopping = false;
+
+    LuaWorker();
+    void run();
+};
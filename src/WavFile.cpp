@@ -0,0 +1,142 @@
+// WavFile.cpp
+
+#include "WavFile.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+static uint32_t readLE(const unsigned char *p, int bytes)
+{
+    uint32_t value = 0;
+    for (int i = bytes - 1; i >= 0; i--)
+        value = (value << 8) | p[i];
+    return value;
+}
+
+static void writeLE(FILE *file, uint32_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+        std::fputc((value >> (8 * i)) & 0xff, file);
+}
+
+static float decodeSample(const unsigned char *p, int format, int bits)
+{
+    if (format == 3)
+    {
+        if (bits == 32)
+        {
+            uint32_t raw = readLE(p, 4);
+            float f;
+            std::memcpy(&f, &raw, 4);
+            return f;
+        }
+        uint64_t raw = (uint64_t)readLE(p, 4) | ((uint64_t)readLE(p + 4, 4) << 32);
+        double d;
+        std::memcpy(&d, &raw, 8);
+        return (float)d;
+    }
+
+    // 8-bit PCM is unsigned, wider PCM is signed
+    if (bits == 8)
+        return (p[0] - 128) / 128.f;
+    int bytes = bits / 8;
+    int32_t value = (int32_t)(readLE(p, bytes) << (32 - bits));
+    return value / 2147483648.f;
+}
+
+bool WavFile::read(const std::string &path, std::string &error)
+{
+    FILE *file = std::fopen(path.c_str(), "rb");
+    if (!file)
+    {
+        error = "Could not open " + path;
+        return false;
+    }
+
+    std::vector<unsigned char> data;
+    unsigned char buffer[4096];
+    size_t n;
+    while ((n = std::fread(buffer, 1, sizeof(buffer), file)) > 0)
+        data.insert(data.end(), buffer, buffer + n);
+    std::fclose(file);
+
+    if (data.size() < 12 || std::memcmp(&data[0], "RIFF", 4) || std::memcmp(&data[8], "WAVE", 4))
+    {
+        error = "Not a WAV file: " + path;
+        return false;
+    }
+
+    // Walk the chunks for the format and the sample data
+    int format = 0, bits = 0;
+    const unsigned char *samplesStart = nullptr;
+    size_t samplesSize = 0;
+    size_t pos = 12;
+    while (pos + 8 <= data.size())
+    {
+        uint32_t size = readLE(&data[pos + 4], 4);
+        const unsigned char *chunk = &data[pos + 8];
+        size_t available = std::min<size_t>(size, data.size() - pos - 8);
+
+        if (!std::memcmp(&data[pos], "fmt ", 4) && available >= 16)
+        {
+            format = readLE(chunk, 2);
+            channels = readLE(chunk + 2, 2);
+            sampleRate = readLE(chunk + 4, 4);
+            bits = readLE(chunk + 14, 2);
+
+            // WAVE_FORMAT_EXTENSIBLE stores the real format in the sub-format GUID
+            if (format == 0xfffe && available >= 26)
+                format = readLE(chunk + 24, 2);
+        }
+        else if (!std::memcmp(&data[pos], "data", 4))
+        {
+            samplesStart = chunk;
+            samplesSize = available;
+        }
+        pos += 8 + size + (size & 1);
+    }
+
+    bool supported = (format == 1 && (bits == 8 || bits == 16 || bits == 24 || bits == 32)) || (format == 3 && (bits == 32 || bits == 64));
+    if (!supported || channels <= 0 || !samplesStart)
+    {
+        error = "Unsupported WAV format in " + path;
+        return false;
+    }
+
+    int frameBytes = channels * bits / 8;
+    size_t frames = samplesSize / frameBytes;
+    samples.resize(frames * channels);
+    for (size_t i = 0; i < frames * channels; i++)
+        samples[i] = decodeSample(samplesStart + i * (bits / 8), format, bits);
+    return true;
+}
+
+bool WavFile::write(const std::string &path) const
+{
+    FILE *file = std::fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+
+    uint32_t dataSize = (uint32_t)(samples.size() * 4);
+    std::fwrite("RIFF", 1, 4, file);
+    writeLE(file, 36 + dataSize, 4);
+    std::fwrite("WAVEfmt ", 1, 8, file);
+    writeLE(file, 16, 4);
+    writeLE(file, 3, 2); // IEEE float
+    writeLE(file, channels, 2);
+    writeLE(file, sampleRate, 4);
+    writeLE(file, sampleRate * channels * 4, 4);
+    writeLE(file, channels * 4, 2);
+    writeLE(file, 32, 2);
+    std::fwrite("data", 1, 4, file);
+    writeLE(file, dataSize, 4);
+
+    for (float sample : samples)
+    {
+        uint32_t raw;
+        std::memcpy(&raw, &sample, 4);
+        writeLE(file, raw, 4);
+    }
+    return std::fclose(file) == 0;
+}
@@ -0,0 +1,22 @@
+// WavFile.hpp
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Interleaved audio read from or written to a RIFF WAVE file
+struct WavFile
+{
+    int sampleRate = 0;
+    int channels = 0;
+    std::vector<float> samples;
+
+    size_t getFrames() const { return channels > 0 ? samples.size() / channels : 0; }
+
+    // Reads 8/16/24/32-bit PCM and 32/64-bit float files, sets `error` on failure
+    bool read(const std::string &path, std::string &error);
+
+    // Writes 32-bit float
+    bool write(const std::string &path) const;
+};
@@ -1,13 +1,26 @@
 // plugin.cpp
 
 #include "plugin.hpp"
+#include "LuaScript.hpp"
 #include <osdialog.h>
 
 Plugin *pluginInstance;
 
+// Route messages from the Lua host to Rack's log.txt
+static void logLuaMessage(int level, const char *message)
+{
+    if (level >= 2)
+        WARN("%s", message);
+    else if (level == 1)
+        INFO("%s", message);
+    else
+        DEBUG("%s", message);
+}
+
 void init(Plugin *p)
 {
     pluginInstance = p;
+    LuaScript::logHandler = logLuaMessage;
 
     // Add modules here
     p->addModel(modelLuaBox);
@@ -0,0 +1,140 @@
+// arena.cpp
+
+// Churns a LuaArena with mixed allocations, reallocations and frees the way a Lua state does,
+// and checks that every byte comes back: `used` returns to its baseline and the full capacity can be allocated again
+// Build and run with `make test` from the repository root
+
+#include "LuaArena.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+struct Block
+{
+    void *ptr;
+    size_t size;
+    unsigned char fill;
+};
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+    if (!ok)
+    {
+        std::printf("FAIL %s\n", what);
+        failures++;
+    }
+}
+
+static bool intact(const Block &block)
+{
+    const unsigned char *p = static_cast<const unsigned char *>(block.ptr);
+    for (size_t i = 0; i < block.size; i++)
+    {
+        if (p[i] != block.fill)
+            return false;
+    }
+    return true;
+}
+
+// Sizes like a Lua state's: mostly small objects, some strings and tables, now and then a large buffer
+static size_t randomSize(std::mt19937 &rng)
+{
+    int kind = rng() % 100;
+    if (kind < 70)
+        return 8 + rng() % 120;
+    if (kind < 95)
+        return 128 + rng() % 4096;
+    return 4096 + rng() % 65536;
+}
+
+// Fills the arena with blocks of one size until it refuses, then frees them all, returns the number of blocks
+static size_t fillAndFree(LuaArena &arena, size_t size)
+{
+    std::vector<void *> blocks;
+    while (void *ptr = LuaArena::alloc(&arena, nullptr, 0, size))
+        blocks.push_back(ptr);
+    for (void *ptr : blocks)
+        LuaArena::alloc(&arena, ptr, size, 0);
+    return blocks.size();
+}
+
+int main()
+{
+    const size_t capacity = 4 << 20;
+    LuaArena arena(capacity);
+    check(arena.getCapacity() == capacity, "arena reserved");
+    check(arena.getUsed() == 0, "empty arena uses nothing");
+
+    // Fresh arena, as many 1 KB blocks as fit
+    size_t fresh = fillAndFree(arena, 1000);
+    check(arena.getUsed() == 0, "used back to 0 after the first fill");
+
+    std::mt19937 rng(1);
+    std::vector<Block> live;
+    for (int round = 0; round < 200000; round++)
+    {
+        int op = rng() % 10;
+        if (op < 4 || live.empty())
+        {
+            Block block = {nullptr, randomSize(rng), (unsigned char)rng()};
+            block.ptr = LuaArena::alloc(&arena, nullptr, 0, block.size);
+            if (!block.ptr)
+                continue;
+            std::memset(block.ptr, block.fill, block.size);
+            live.push_back(block);
+        }
+        else if (op < 7)
+        {
+            // Grow or shrink, shrinking a full arena must keep the block
+            Block &block = live[rng() % live.size()];
+            size_t size = (rng() % 2) ? block.size / (1 + rng() % 8) + 1 : randomSize(rng);
+            void *ptr = LuaArena::alloc(&arena, block.ptr, block.size, size);
+            if (!ptr)
+            {
+                check(size > block.size, "shrinking never fails");
+                continue;
+            }
+            block.ptr = ptr;
+            block.size = std::min(block.size, size);
+            check(intact(block), "contents kept through realloc");
+            block.size = size;
+            std::memset(block.ptr, block.fill, block.size);
+        }
+        else
+        {
+            size_t i = rng() % live.size();
+            check(intact(live[i]), "contents intact until freed");
+            LuaArena::alloc(&arena, live[i].ptr, live[i].size, 0);
+            live[i] = live.back();
+            live.pop_back();
+        }
+        if (failures > 10)
+            break;
+    }
+    std::printf("churn: %zu allocations, peak %zu KB of %zu KB, %s\n", arena.getAllocations(), arena.getPeak() >> 10,
+                capacity >> 10, arena.isExhausted() ? "filled up" : "never full");
+    check(arena.isExhausted(), "churn reached the capacity");
+
+    for (const Block &block : live)
+        LuaArena::alloc(&arena, block.ptr, block.size, 0);
+    check(arena.getUsed() == 0, "used back to 0 after the churn");
+
+    // Blocks taken from larger classes went back to them, so the fresh region still holds the same 1 KB blocks
+    size_t after = fillAndFree(arena, 1000);
+    std::printf("1 KB blocks: %zu fresh, %zu after the churn\n", fresh, after);
+    check(after == fresh, "no capacity lost to the churn");
+    check(arena.getUsed() == 0, "used back to 0 at the end");
+
+    if (failures)
+    {
+        std::printf("%d checks failed\n", failures);
+        return 1;
+    }
+    std::printf("All arena checks passed\n");
+    return 0;
+}
@@ -0,0 +1,383 @@
+// render.cpp
+
+// Offline renderer, runs a script on the LuaBox host core as fast as possible and writes its outputs to WAV
+// Build with `make render` from the repository root
+
+#include "LuaScript.hpp"
+#include "WavFile.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A knob or button change at a point in time, rows are 1-based in the file like in Lua
+struct AutomationEvent
+{
+    double time;
+    bool button;
+    int row;
+    float value;
+};
+
+struct RenderOptions
+{
+    double seconds = 10.0;
+    int sampleRate = 48000;
+    int blockSize = 64;
+    int gcBudget = 50;
+    float gain = 0.1f;
+    int jobs = 1;
+    std::string libDir = "res/lua";
+    std::string output;
+    std::string outputDir = ".";
+    std::string inputPaths[NUM_ROWS];
+    std::string automationPath;
+    std::vector<std::string> scripts;
+};
+
+struct RenderResult
+{
+    bool ok = false;
+    std::string message;
+    double seconds = 0.0;
+};
+
+static void logMessage(int level, const char *message)
+{
+    if (level >= 1)
+        std::fprintf(stderr, "%s\n", message);
+}
+
+static std::string baseName(const std::string &path)
+{
+    size_t slash = path.find_last_of("/\\");
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+static std::string dirName(const std::string &path)
+{
+    size_t slash = path.find_last_of("/\\");
+    return slash == std::string::npos ? "." : path.substr(0, slash);
+}
+
+static std::string stem(const std::string &path)
+{
+    std::string name = baseName(path);
+    size_t dot = name.find_last_of('.');
+    return dot == std::string::npos ? name : name.substr(0, dot);
+}
+
+// One event per line: `<seconds> knob|button <row> <value>`, blank lines and `#` comments are skipped
+static bool readAutomation(const std::string &path, std::vector<AutomationEvent> &events, std::string &error)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        error = "Could not open " + path;
+        return false;
+    }
+
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line))
+    {
+        lineNumber++;
+        if (line.empty() || line[0] == '#' || line.find_first_not_of(" \t\r") == std::string::npos)
+            continue;
+
+        std::istringstream in(line);
+        AutomationEvent event;
+        std::string kind;
+        if (!(in >> event.time >> kind >> event.row >> event.value) || (kind != "knob" && kind != "button") ||
+            event.row < 1 || event.row > NUM_ROWS)
+        {
+            error = path + ":" + std::to_string(lineNumber) + ": expected `<seconds> knob|button <row 1-8> <value>`";
+            return false;
+        }
+        event.button = kind == "button";
+        event.row--;
+        events.push_back(event);
+    }
+
+    std::stable_sort(events.begin(), events.end(),
+                     [](const AutomationEvent &a, const AutomationEvent &b) { return a.time < b.time; });
+    return true;
+}
+
+// Runs the script with the same call pattern and latency as LuaBox::process()
+static RenderResult render(const RenderOptions &options, const std::string &path, const WavFile *inputs[NUM_ROWS],
+                           const std::vector<AutomationEvent> &automation, const std::string &outputPath)
+{
+    RenderResult result;
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        result.message = "Could not open " + path;
+        return result;
+    }
+    std::string source((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    LuaScript script;
+    script.sampleDir = dirName(path);
+    script.resetBlock((float)options.sampleRate, options.blockSize);
+    if (!script.load(source, "=" + baseName(path), options.libDir))
+    {
+        result.message = script.errorMessage;
+        return result;
+    }
+
+    int64_t totalFrames = (int64_t)(options.seconds * options.sampleRate);
+    WavFile output;
+    output.sampleRate = options.sampleRate;
+    output.channels = NUM_ROWS;
+    output.samples.assign(totalFrames * NUM_ROWS, 0.f);
+
+    float knobs[NUM_ROWS] = {};
+    bool buttons[NUM_ROWS] = {};
+    size_t nextEvent = 0;
+    LuaProcessBlock &block = script.block;
+
+    uint64_t start = LuaProfiler::getNanoseconds();
+    for (int64_t frame = 0; frame < totalFrames; frame++)
+    {
+        // Apply automation due at this frame
+        double time = (double)frame / options.sampleRate;
+        while (nextEvent < automation.size() && automation[nextEvent].time <= time)
+        {
+            const AutomationEvent &event = automation[nextEvent++];
+            if (event.button)
+                buttons[event.row] = event.value > 0.f;
+            else
+                knobs[event.row] = std::max(-1.f, std::min(event.value, 1.f));
+        }
+
+        // Input files are read as volts, scaled back up by the output gain
+        float voltages[NUM_ROWS];
+        for (int i = 0; i < NUM_ROWS; i++)
+        {
+            const WavFile *input = inputs[i];
+            bool playing = input && (size_t)frame < input->getFrames();
+            voltages[i] = playing ? input->samples[frame * input->channels] / options.gain : 0.f;
+        }
+
+        float *out = &output.samples[frame * NUM_ROWS];
+        if (script.blockMode)
+        {
+            // Outputs come from the previous block, so block mode keeps its `blocksize` latency
+            int n = script.blockIndex;
+            for (int i = 0; i < NUM_ROWS; i++)
+            {
+                block.inputs[i][n] = voltages[i];
+                block.knobs[i][n] = knobs[i];
+                block.buttons[i][n] = buttons[i];
+                block.polyinputs[n][i][0] = voltages[i];
+                out[i] = block.outchannels[i] > 0 ? block.polyoutputs[n][i][0] : block.outputs[i][n];
+            }
+            if (++script.blockIndex < block.blocksize)
+                continue;
+
+            int frames = block.blocksize;
+            block.frame = frame - (frames - 1);
+            for (int i = 0; i < NUM_ROWS; i++)
+            {
+                block.input[i] = voltages[i];
+                block.knob[i] = knobs[i];
+                block.button[i] = buttons[i];
+                block.inchannels[i] = inputs[i] ? 1 : 0;
+                block.polyinput[i][0] = voltages[i];
+            }
+            script.blockIndex = 0;
+            if (!script.runBlock(frames))
+            {
+                result.message = script.errorMessage;
+                return result;
+            }
+            script.collectGarbage(options.gcBudget * 1e-6);
+        }
+        else
+        {
+            block.frame = frame;
+            for (int i = 0; i < NUM_ROWS; i++)
+            {
+                block.input[i] = voltages[i];
+                block.knob[i] = knobs[i];
+                block.button[i] = buttons[i];
+                block.inchannels[i] = inputs[i] ? 1 : 0;
+                block.polyinput[i][0] = voltages[i];
+            }
+            if (!script.run())
+            {
+                result.message = script.errorMessage;
+                return result;
+            }
+            for (int i = 0; i < NUM_ROWS; i++)
+                out[i] = block.outchannels[i] > 0 ? block.polyoutput[i][0] : block.output[i];
+
+            if (++script.gcFrames >= options.blockSize)
+            {
+                script.gcFrames = 0;
+                script.collectGarbage(options.gcBudget * 1e-6);
+            }
+        }
+    }
+    result.seconds = (LuaProfiler::getNanoseconds() - start) * 1e-9;
+
+    for (float &sample : output.samples)
+        sample *= options.gain;
+    if (!output.write(outputPath))
+    {
+        result.message = "Could not write " + outputPath;
+        return result;
+    }
+
+    char message[512];
+    std::snprintf(message, sizeof(message), "%s: %.2f s rendered in %.3f s, %.1fx realtime", outputPath.c_str(), options.seconds,
+                  result.seconds, result.seconds > 0.0 ? options.seconds / result.seconds : 0.0);
+    result.ok = true;
+    result.message = message;
+    return result;
+}
+
+static void printUsage()
+{
+    std::printf("Usage: luabox-render [options] script.lua [script.lua ...]\n"
+                "  --seconds N       Duration (default 10)\n"
+                "  --rate N          Sample rate (default 48000)\n"
+                "  --block N         Block size for `process_block()` and GC steps (default 64)\n"
+                "  --input ROW=PATH  WAV file for input row 1-8, first channel, samples are volts times the gain\n"
+                "  --automation PATH Knob and button events, one `<seconds> knob|button <row> <value>` per line\n"
+                "  --gain N          Scale from volts to samples (default 0.1, so 10 V is full scale)\n"
+                "  -o PATH           Output WAV for a single script\n"
+                "  --out-dir DIR     Output directory, files are named after the scripts (default .)\n"
+                "  -j N              Render N scripts in parallel (default 1, 0 for all cores)\n"
+                "  --lib DIR         Directory with util.lua and ffi.lua (default res/lua)\n"
+                "Outputs are 8-channel 32-bit float WAV files, one channel per output row\n");
+}
+
+int main(int argc, char **argv)
+{
+    RenderOptions options;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--seconds" && hasValue)
+            options.seconds = std::atof(argv[++i]);
+        else if (arg == "--rate" && hasValue)
+            options.sampleRate = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--block" && hasValue)
+            options.blockSize = std::max(1, std::min(std::atoi(argv[++i]), MAX_BLOCK_SIZE));
+        else if (arg == "--gain" && hasValue)
+            options.gain = (float)std::atof(argv[++i]);
+        else if (arg == "--automation" && hasValue)
+            options.automationPath = argv[++i];
+        else if (arg == "-o" && hasValue)
+            options.output = argv[++i];
+        else if (arg == "--out-dir" && hasValue)
+            options.outputDir = argv[++i];
+        else if (arg == "-j" && hasValue)
+            options.jobs = std::max(0, std::atoi(argv[++i]));
+        else if (arg == "--lib" && hasValue)
+            options.libDir = argv[++i];
+        else if (arg == "--input" && hasValue)
+        {
+            std::string value = argv[++i];
+            size_t equals = value.find('=');
+            int row = equals == std::string::npos ? 0 : std::atoi(value.substr(0, equals).c_str());
+            if (row < 1 || row > NUM_ROWS)
+            {
+                std::fprintf(stderr, "Expected --input ROW=PATH with ROW 1-8, got %s\n", value.c_str());
+                return 1;
+            }
+            options.inputPaths[row - 1] = value.substr(equals + 1);
+        }
+        else if (arg == "-h" || arg == "--help")
+        {
+            printUsage();
+            return 0;
+        }
+        else if (arg[0] == '-')
+        {
+            printUsage();
+            return 1;
+        }
+        else
+            options.scripts.push_back(arg);
+    }
+
+    if (options.scripts.empty() || options.gain == 0.f || (!options.output.empty() && options.scripts.size() > 1))
+    {
+        printUsage();
+        return 1;
+    }
+
+    LuaScript::logHandler = logMessage;
+
+    // Inputs and automation are shared read-only by all renders
+    WavFile inputFiles[NUM_ROWS];
+    const WavFile *inputs[NUM_ROWS] = {};
+    for (int i = 0; i < NUM_ROWS; i++)
+    {
+        if (options.inputPaths[i].empty())
+            continue;
+        std::string error;
+        if (!inputFiles[i].read(options.inputPaths[i], error))
+        {
+            std::fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+        if (inputFiles[i].sampleRate != options.sampleRate)
+            std::fprintf(stderr, "Warning: %s is %d Hz and is not resampled to %d Hz\n", options.inputPaths[i].c_str(),
+                         inputFiles[i].sampleRate, options.sampleRate);
+        inputs[i] = &inputFiles[i];
+    }
+
+    std::vector<AutomationEvent> automation;
+    std::string error;
+    if (!options.automationPath.empty() && !readAutomation(options.automationPath, automation, error))
+    {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+
+    // Each script has its own Lua state, so scripts render independently on a simple work queue
+    std::vector<RenderResult> results(options.scripts.size());
+    std::atomic<size_t> next{0};
+    auto work = [&]() {
+        for (size_t i; (i = next++) < options.scripts.size();)
+        {
+            const std::string &path = options.scripts[i];
+            std::string outputPath = !options.output.empty() ? options.output : options.outputDir + "/" + stem(path) + ".wav";
+            results[i] = render(options, path, inputs, automation, outputPath);
+        }
+    };
+
+    int jobs = options.jobs > 0 ? options.jobs : std::max(1, (int)std::thread::hardware_concurrency());
+    jobs = std::min<int>(jobs, options.scripts.size());
+    std::vector<std::thread> threads;
+    for (int i = 1; i < jobs; i++)
+        threads.emplace_back(work);
+    work();
+    for (std::thread &thread : threads)
+        thread.join();
+
+    int failed = 0;
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        if (results[i].ok)
+            std::printf("%s\n", results[i].message.c_str());
+        else
+        {
+            std::fprintf(stderr, "%s: %s\n", options.scripts[i].c_str(), results[i].message.c_str());
+            failed++;
+        }
+    }
+    return failed ? 1 : 0;
+}